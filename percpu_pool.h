@@ -0,0 +1,398 @@
+#pragma once
+
+#include "pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <sched.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define POOL_HAVE_RSEQ 1
+#else
+#define POOL_HAVE_RSEQ 0
+#endif
+
+// An object pool whose free slots are cached per CPU rather than per thread, so
+// the memory parked in caches scales with the number of CPUs instead of the
+// number of threads. Objects may be constructed and destroyed on any thread.
+//
+// With restartable sequences available (x86-64 Linux, glibc 2.35+ registers rseq
+// for every thread), pushing to and popping from the current CPU's free list run
+// inside an rseq critical section. The kernel aborts the sequence if the thread is
+// preempted or migrated before the final store, so the list needs no atomic
+// instructions. Otherwise each CPU's list is protected by a lock. When a CPU's
+// list runs dry, a batch of slots is carved from a shared Pool under a mutex.
+//
+// destroy_deferred() queues objects on a shared list instead of destroying them
+// inline. drain() destroys the queued objects as a batch; drain_in_background()
+// starts a worker that does so whenever a batch has built up.
+template <typename T>
+class PerCpuPool
+{
+public:
+    using type = T;
+    using pointer = T*;
+
+    PerCpuPool(size_t batchSize = 64)
+        : m_lists(std::max(sysconf(_SC_NPROCESSORS_CONF), 1L))
+        , m_batchSize(batchSize)
+        , m_slots(batchSize)
+        , m_useRseq(rseq_registered())
+    {
+        assert(batchSize > 0); // Must refill at least one slot at a time.
+    }
+
+    // Stops the background drainer, if any, and destroys any queued objects.
+    ~PerCpuPool()
+    {
+        if (m_drainer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_deferredMutex);
+                m_stopDrainer = true;
+            }
+            m_deferredReady.notify_one();
+            m_drainer.join();
+        }
+        drain();
+    }
+
+    // Non-copyable, non-movable: threads hold pointers into the per-CPU lists.
+    PerCpuPool(const PerCpuPool&) = delete;
+    PerCpuPool& operator=(const PerCpuPool&) = delete;
+
+    template <typename ...Ts>
+    [[nodiscard]] pointer construct(Ts&& ...args)
+    {
+        return new (allocate()) type(std::forward<Ts>(args)...);
+    }
+
+    void destroy(pointer p)
+    {
+        if (p == nullptr)
+            return;
+
+        p->~type();
+        deallocate(p);
+    }
+
+    // Queue p to be destroyed by a later drain() instead of now. May be called
+    // from any thread; p stays live until it is drained.
+    void destroy_deferred(pointer p)
+    {
+        if (p == nullptr)
+            return;
+
+        bool batchReady;
+        {
+            std::lock_guard<std::mutex> lock(m_deferredMutex);
+            m_deferred.push_back(p);
+            batchReady = m_deferred.size() == m_batchSize;
+        }
+
+        if (batchReady)
+            m_deferredReady.notify_one();
+    }
+
+    // Destroy every queued object and push their slots onto the current CPU's
+    // list as one chain.
+    void drain()
+    {
+        std::vector<pointer> batch;
+        {
+            std::lock_guard<std::mutex> lock(m_deferredMutex);
+            batch.swap(m_deferred);
+        }
+
+        if (batch.empty())
+            return;
+
+        for (pointer p : batch)
+            p->~type();
+
+        Slot* first = reinterpret_cast<Slot*>(batch.front());
+        Slot* last = first;
+        for (size_t i = 1; i < batch.size(); ++i)
+        {
+            Slot* slot = reinterpret_cast<Slot*>(batch[i]);
+            last->m_next = slot;
+            last = slot;
+        }
+        push(first, last);
+    }
+
+    // Start a worker thread that drains the queue whenever a batch of objects
+    // has been queued, and at least every `interval` otherwise. It runs until
+    // the pool is destroyed.
+    void drain_in_background(std::chrono::milliseconds interval = std::chrono::milliseconds(10))
+    {
+        assert(!m_drainer.joinable()); // Only one drainer per pool.
+        m_drainer = std::thread([this, interval] {
+            std::unique_lock<std::mutex> lock(m_deferredMutex);
+            while (!m_stopDrainer)
+            {
+                m_deferredReady.wait_for(lock, interval, [this] {
+                    return m_stopDrainer || m_deferred.size() >= m_batchSize;
+                });
+
+                lock.unlock();
+                drain();
+                lock.lock();
+            }
+        });
+    }
+
+    // Number of objects the pool's blocks can hold.
+    size_t capacity() const
+    {
+        std::lock_guard<std::mutex> lock(m_slotsMutex);
+        return m_slots.capacity();
+    }
+
+    // Whether the free lists are accessed with rseq rather than locks.
+    bool uses_rseq() const { return m_useRseq; }
+
+private:
+    union Slot
+    {
+        Slot() {}
+
+        std::aligned_storage_t<sizeof(T), alignof(T)> m_storage;
+        Slot* m_next;
+    };
+
+    struct alignas(64) CpuList
+    {
+        Slot* m_head = nullptr;
+        std::mutex m_mutex;
+    };
+
+    [[nodiscard]] void* allocate()
+    {
+#if POOL_HAVE_RSEQ
+        if (m_useRseq)
+        {
+            for (;;)
+            {
+                const int cpu = current_cpu();
+                if (cpu < 0)
+                    break;
+
+                Slot* slot;
+                const int result = rseq_pop(&m_lists[cpu].m_head, &slot, cpu);
+                if (result == 0)
+                    return &slot->m_storage;
+                if (result > 0)
+                    return refill();
+                // Preempted or migrated: retry on whichever CPU we are on now.
+            }
+        }
+#endif
+        CpuList& list = locked_list();
+        {
+            std::lock_guard<std::mutex> lock(list.m_mutex);
+            if (Slot* slot = list.m_head)
+            {
+                list.m_head = slot->m_next;
+                return &slot->m_storage;
+            }
+        }
+        return refill();
+    }
+
+    void deallocate(void* p) noexcept
+    {
+        Slot* slot = reinterpret_cast<Slot*>(p);
+        push(slot, slot);
+    }
+
+    // Carve a batch of slots from the shared pool, keep one and push the rest
+    // onto the current CPU's list.
+    [[nodiscard]] void* refill()
+    {
+        Slot* first;
+        Slot* last;
+        {
+            std::lock_guard<std::mutex> lock(m_slotsMutex);
+            first = last = m_slots.construct();
+            for (size_t i = 1; i < m_batchSize; ++i)
+            {
+                Slot* slot = m_slots.construct();
+                last->m_next = slot;
+                last = slot;
+            }
+        }
+
+        if (first != last)
+            push(first->m_next, last);
+
+        return &first->m_storage;
+    }
+
+    // Push the chain first..last onto the current CPU's list.
+    void push(Slot* first, Slot* last) noexcept
+    {
+#if POOL_HAVE_RSEQ
+        if (m_useRseq)
+        {
+            for (;;)
+            {
+                const int cpu = current_cpu();
+                if (cpu < 0)
+                    break;
+
+                Slot** head = &m_lists[cpu].m_head;
+                Slot* expected = __atomic_load_n(head, __ATOMIC_RELAXED);
+                last->m_next = expected;
+                if (rseq_push(head, expected, first, cpu) == 0)
+                    return;
+            }
+        }
+#endif
+        CpuList& list = locked_list();
+        std::lock_guard<std::mutex> lock(list.m_mutex);
+        last->m_next = list.m_head;
+        list.m_head = first;
+    }
+
+    // The list to use when not going through rseq. In rseq mode this is a
+    // separate overflow list, so locked and lock-free accesses never mix.
+    CpuList& locked_list()
+    {
+        if (m_useRseq)
+            return m_overflow;
+
+        const int cpu = sched_getcpu();
+        return m_lists[cpu < 0 ? 0 : static_cast<size_t>(cpu) % m_lists.size()];
+    }
+
+#if POOL_HAVE_RSEQ
+    static struct rseq* rseq_area()
+    {
+        return reinterpret_cast<struct rseq*>(static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+    }
+
+    static bool rseq_registered()
+    {
+        return __rseq_size > 0 && static_cast<int>(rseq_area()->cpu_id) >= 0;
+    }
+
+    // The CPU this thread is running on, or -1 if it has no usable rseq area
+    // (not registered, or a CPU number beyond what we sized the lists for).
+    int current_cpu() const
+    {
+        const int cpu = static_cast<int>(__atomic_load_n(&rseq_area()->cpu_id, __ATOMIC_RELAXED));
+        return cpu >= 0 && static_cast<size_t>(cpu) < m_lists.size() ? cpu : -1;
+    }
+
+    static_assert(RSEQ_SIG == 0x53053053, "the abort handler signature below is hard-coded");
+
+    // The critical sections follow librseq's x86-64 sequences. Each one publishes
+    // its descriptor (start, length, abort handler) in the thread's rseq area,
+    // checks it is still on `cpu`, and commits with a single store at its end.
+
+    // If *head == expected, store newHead to *head. Returns 0 on success, 1 if
+    // *head changed, or -1 if the sequence was aborted.
+    static int rseq_push(Slot** head, Slot* expected, Slot* newHead, int cpu)
+    {
+        __asm__ __volatile__ goto(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0, 0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %%fs:8(%[rseqOffset])\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %%fs:4(%[rseqOffset])\n\t"
+            "jnz 4f\n\t"
+            "cmpq %[head], %[expected]\n\t"
+            "jnz %l[changed]\n\t"
+            "movq %[newHead], %[head]\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[aborted]\n\t"
+            ".popsection\n\t"
+            :
+            : [cpu] "r" (cpu),
+              [rseqOffset] "r" (__rseq_offset),
+              [head] "m" (*head),
+              [expected] "r" (expected),
+              [newHead] "r" (newHead)
+            : "memory", "cc", "rax"
+            : aborted, changed);
+        return 0;
+    aborted:
+        return -1;
+    changed:
+        return 1;
+    }
+
+    // If *head is not null, store it to *out and replace *head with its m_next.
+    // Returns 0 on success, 1 if the list is empty, or -1 if the sequence was
+    // aborted.
+    static int rseq_pop(Slot** head, Slot** out, int cpu)
+    {
+        static_assert(offsetof(Slot, m_next) == 0);
+        __asm__ __volatile__ goto(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0, 0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %%fs:8(%[rseqOffset])\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %%fs:4(%[rseqOffset])\n\t"
+            "jnz 4f\n\t"
+            "movq %[head], %%rbx\n\t"
+            "testq %%rbx, %%rbx\n\t"
+            "jz %l[empty]\n\t"
+            "movq %%rbx, %[out]\n\t"
+            "movq (%%rbx), %%rbx\n\t"
+            "movq %%rbx, %[head]\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[aborted]\n\t"
+            ".popsection\n\t"
+            :
+            : [cpu] "r" (cpu),
+              [rseqOffset] "r" (__rseq_offset),
+              [head] "m" (*head),
+              [out] "m" (*out)
+            : "memory", "cc", "rax", "rbx"
+            : aborted, empty);
+        return 0;
+    aborted:
+        return -1;
+    empty:
+        return 1;
+    }
+#else
+    static bool rseq_registered() { return false; }
+#endif
+
+    std::vector<CpuList> m_lists;
+    CpuList m_overflow;
+    size_t m_batchSize;
+    mutable std::mutex m_slotsMutex;
+    Pool<Slot> m_slots;
+    bool m_useRseq;
+
+    std::mutex m_deferredMutex;
+    std::condition_variable m_deferredReady;
+    std::vector<pointer> m_deferred;
+    bool m_stopDrainer = false;
+    std::thread m_drainer;
+};
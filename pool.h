@@ -1,223 +1,3055 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 
-constexpr bool DEBUG_PRINT = false;
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define POOL_HAVE_BACKTRACE 1
+#else
+#define POOL_HAVE_BACKTRACE 0
+#endif
 
-// An object pool for a particular type. Stores blocks of memory to be doled
-// out as requested via the construct function. The destroy function frees the
-// given memory and allows memory reuse. When a memory block is exhausted, the
-// pool allocates a new block of greater size, as determined by the given growth
-// factor. Destroying pointers takes O(1) time. The release function allows the
-// user to return all memory to the upstream allocator without running destructors.
-// The free list spans all blocks managed by the pool.
-template <typename T, size_t GrowthFactor = 2, size_t MaxBlockSize = 1024>
-class Pool
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#define POOL_HAVE_CXXABI 1
+#else
+#define POOL_HAVE_CXXABI 0
+#endif
+
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#define POOL_HAVE_MADVISE 1
+#else
+#define POOL_HAVE_MADVISE 0
+#endif
+
+#if __has_include(<pthread.h>)
+#include <pthread.h>
+#define POOL_HAVE_ATFORK 1
+#else
+#define POOL_HAVE_ATFORK 0
+#endif
+
+// A counter written by one thread and read by any. Relaxed loads and stores
+// make updating it as cheap as a plain variable. Copying copies the value.
+class RelaxedCounter
 {
 public:
-    using type = T;
-    using pointer = T*;
+    RelaxedCounter(size_t value = 0) : m_value(value) {}
+    RelaxedCounter(const RelaxedCounter& other) : m_value(other.load()) {}
+    RelaxedCounter& operator=(const RelaxedCounter& other) { store(other.load()); return *this; }
 
-    Pool(size_t size = 1)
-        : m_blocks()
-        , m_blockSize(size)
-        , m_nextFree(nullptr)
-    {
-        assert(size > 0); // Pool must hold at least one object to start.
-        assert(size <= MaxBlockSize); // Block must not exceed max block size.
+    size_t load() const { return m_value.load(std::memory_order_relaxed); }
+    void store(size_t value) { m_value.store(value, std::memory_order_relaxed); }
+    operator size_t() const { return load(); }
 
-        m_blocks.push_back(std::make_unique<Item[]>(size));
+    RelaxedCounter& operator+=(size_t n) { store(load() + n); return *this; }
+    RelaxedCounter& operator-=(size_t n) { store(load() - n); return *this; }
 
-        if constexpr (DEBUG_PRINT)
-        {
-            std::cout << "Allocating " << sizeof(Item) << " (obj size) * "
-                      << size << " (block size) = " << sizeof(Item) * size << " bytes\n";
-        }
+private:
+    std::atomic<size_t> m_value;
+};
+
+// A snapshot of a pool's size, safe to take from any thread.
+struct PoolStats
+{
+    size_t m_capacity;   // Slots in all blocks.
+    size_t m_live;       // Slots handed out and not returned.
+    size_t m_blocks;
+    size_t m_slotSize;   // Bytes per slot.
+};
+
+// Observers are a Pool policy that is told about the pool's events. Derive from
+// PoolObserver and hide the callbacks of interest. The base callbacks do
+// nothing and the observer takes no space, so a pool with the default observer
+// compiles as if it had no hooks at all. A pool's observer is reachable through
+// Pool::observer().
+struct PoolObserver
+{
+    // A block of `slots` slots, `bytes` long, was allocated, or taken over
+    // from another pool by merge() or steal_free().
+    void on_grow(const void* /*block*/, size_t /*slots*/, size_t /*bytes*/) {}
 
-        auto& firstBlock = m_blocks.front();
-        for (size_t i = 1; i < size; ++i)
-            firstBlock[i-1].m_next = &firstBlock[i];
+    // A block was returned to the upstream allocator, or handed to another pool.
+    void on_release(const void* /*block*/, size_t /*slots*/, size_t /*bytes*/) {}
 
-        m_nextFree = &firstBlock[0];
+    void on_construct(const void* /*p*/) {}
+    void on_destroy(const void* /*p*/) {}
+
+    // Objects were discarded in bulk, by rollback() or release(), without being
+    // destroyed one by one. discarded(p) tells whether p was one of them.
+    template <typename Pred>
+    void on_discard(Pred&& /*discarded*/) {}
+
+    // Allocating a block of `bytes` failed. std::bad_alloc is thrown next.
+    void on_out_of_memory(size_t /*bytes*/) {}
+};
+
+// Prints every block allocation and release to std::cout.
+struct PrintObserver : PoolObserver
+{
+    void on_grow(const void* block, size_t slots, size_t bytes)
+    {
+        std::cout << "Allocating " << bytes / slots << " (obj size) * " << slots << " (block size) = "
+                  << bytes << " bytes at " << block << "\n";
     }
 
-    // Non-copyable
-    Pool(const Pool&) = delete;
-    Pool& operator=(const Pool&) = delete;
+    void on_release(const void* block, size_t slots, size_t bytes)
+    {
+        std::cout << "Releasing " << slots << " slots, " << bytes << " bytes at " << block << "\n";
+    }
+};
 
-    // Movable
-    Pool(Pool&&) = default;
-    Pool& operator=(Pool&&) = default;
+// Keeps the address range of every block, so that owns(p) can tell whether p
+// points into the pool in time logarithmic in the number of blocks.
+class BlockMapObserver : public PoolObserver
+{
+public:
+    void on_grow(const void* block, size_t /*slots*/, size_t bytes)
+    {
+        const auto* begin = static_cast<const std::byte*>(block);
+        m_blocks.emplace(begin, begin + bytes);
+    }
 
-    template <typename ...Ts>
-    [[nodiscard]] pointer construct(Ts&& ...args)
+    void on_release(const void* block, size_t /*slots*/, size_t /*bytes*/)
     {
-        return new (allocate()) type(std::forward<Ts>(args)...);
+        m_blocks.erase(static_cast<const std::byte*>(block));
     }
 
-    void destroy(pointer p)
+    bool owns(const void* p) const
     {
-        if (p == nullptr)
+        const auto* byte = static_cast<const std::byte*>(p);
+        auto it = m_blocks.upper_bound(byte);
+        return it != m_blocks.begin() && byte < (--it)->second;
+    }
+
+private:
+    std::map<const std::byte*, const std::byte*> m_blocks;  // Start to end.
+};
+
+// Samples the call stacks that construct objects in a pool. Every
+// SampleEvery-th construct records a backtrace, and the sample stays live until
+// its object is destroyed. Use it as a pool's observer, e.g.
+// Pool<T, 2, 1024, GeometricGrowth<2>, HeapProfiler>, and read the profile from
+// Pool::observer(). Unsampled constructs cost a counter decrement, and
+// unsampled destroys a lookup in a small filter table. Sampled constructs take
+// a backtrace and several map updates, which at the default period dominate:
+// the churn benchmark in test_pool.cpp runs a few tenths slower with sampling.
+//
+// Profiles are written in folded-stack format, one "outer;...;inner count" line
+// per stack, as read by flamegraph.pl and speedscope. Counts are scaled up by the
+// sampling period to estimate objects. Link with -rdynamic so that backtraces
+// can name functions in the executable; otherwise frames are shown as addresses.
+class HeapProfiler : public PoolObserver
+{
+public:
+    explicit HeapProfiler(size_t sampleEvery = 1024)
+        : m_sampleEvery(sampleEvery)
+        , m_countdown(sampleEvery)
+    {
+        assert(sampleEvery > 0); // Must sample at least some constructs.
+    }
+
+    void on_construct(const void* p)
+    {
+        if (--m_countdown != 0)
             return;
 
-        p->~type();
-        deallocate(p);
+        m_countdown = m_sampleEvery;
+        sample(p);
     }
 
-    // Deallocate every block! Doesn't run destructors.
-    void release()
+    void on_destroy(const void* p)
     {
-        m_blocks.clear();
-        m_nextFree = nullptr;
+        if (m_filter[filter_slot(p)] != 0)
+            unsample(p);
     }
 
-    bool full() const { return m_nextFree == nullptr; }
+    // Drop the live samples for which discarded(p) is true.
+    template <typename Pred>
+    void on_discard(Pred&& discarded)
+    {
+        for (auto it = m_live.begin(); it != m_live.end();)
+        {
+            if (discarded(it->first))
+            {
+                --m_stacks[it->second].m_live;
+                --m_filter[filter_slot(it->first)];
+                it = m_live.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
 
-    void print() const
+    // Write the estimated number of live objects per construct() call stack, or
+    // of all objects ever constructed if live is false.
+    void write_folded(std::ostream& out, bool live = true) const
     {
-        size_t freeCount = 0;
-        Item* itemPtr = m_nextFree;
-        while (itemPtr != nullptr)
+        for (const Stack& stack : m_stacks)
         {
-            freeCount++;
-            itemPtr = itemPtr->m_next;
+            const size_t samples = live ? stack.m_live : stack.m_total;
+            if (samples == 0)
+                continue;
+
+            const std::vector<std::string> names = symbolize(stack.m_frames);
+            for (size_t i = names.size(); i-- > 0;)
+                out << names[i] << (i == 0 ? " " : ";");
+            out << samples * m_sampleEvery << "\n";
         }
+    }
 
-        std::cout << "Element size: " << sizeof(type) << "\n";
-        std::cout << "Element alignment: " << alignof(type) << "\n";
-        std::cout << "Next free: " << (void*)m_nextFree << "\n";
-        std::cout << "Block size: " << m_blockSize << "\n";
-        std::cout << "Free count: " << freeCount << "\n";
+    size_t live_samples() const { return m_live.size(); }
 
-        std::cout << std::hex << std::setfill('0');
-        for (auto& block : m_blocks)
-        {
-            std::cout << "\nBlock start: " << block.get() << "\n";
-            for (size_t i = 0; i < m_blockSize; ++i)
-            {
-                const pointer p = std::launder(reinterpret_cast<pointer>(&block[i]));
-                const std::byte* p_bytes = reinterpret_cast<std::byte*>(p);
-                for (int j = sizeof(type) - 1; j >= 0; --j)
-                {
-                    if (j == sizeof(type) - 1)
-                        std::cout << (void*)p_bytes << ": ";
+private:
+    static constexpr int MaxFrames = 32;
+    static constexpr size_t FilterSize = 4096;
 
-                    std::cout << std::setw(2) << static_cast<unsigned>(p_bytes[j]) << " ";
+    struct Stack
+    {
+        std::vector<void*> m_frames;   // Innermost first.
+        size_t m_live;
+        size_t m_total;
+    };
 
-                    if (j == 0)
-                        std::cout << "\n";
-                }
+    __attribute__((noinline)) void sample(const void* p)
+    {
+        std::vector<void*> frames;
+#if POOL_HAVE_BACKTRACE
+        void* buffer[MaxFrames];
+        const int depth = backtrace(buffer, MaxFrames);
+        // Leave out this function.
+        frames.assign(buffer + std::min(depth, 1), buffer + depth);
+#endif
+        auto [it, inserted] = m_stackIds.try_emplace(std::move(frames), m_stacks.size());
+        if (inserted)
+            m_stacks.push_back({it->first, 0, 0});
+
+        Stack& stack = m_stacks[it->second];
+        ++stack.m_live;
+        ++stack.m_total;
+        m_live[p] = it->second;
+        ++m_filter[filter_slot(p)];
+    }
+
+    void unsample(const void* p)
+    {
+        auto it = m_live.find(p);
+        if (it == m_live.end())
+            return;
+
+        --m_stacks[it->second].m_live;
+        --m_filter[filter_slot(p)];
+        m_live.erase(it);
+    }
+
+    static size_t filter_slot(const void* p)
+    {
+        return static_cast<size_t>((reinterpret_cast<uintptr_t>(p) * 0x9E3779B97F4A7C15ull) >> 52) % FilterSize;
+    }
+
+    // Function names for frames, demangled where possible, or addresses.
+    static std::vector<std::string> symbolize(const std::vector<void*>& frames)
+    {
+        std::vector<std::string> names;
+#if POOL_HAVE_BACKTRACE
+        std::unique_ptr<char*, void (*)(void*)> symbols(
+            backtrace_symbols(frames.data(), static_cast<int>(frames.size())), std::free);
+#endif
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            std::string name;
+#if POOL_HAVE_BACKTRACE
+            // Symbols look like "binary(mangled+0x1c) [0x5555...]".
+            if (symbols)
+            {
+                const std::string symbol = symbols.get()[i];
+                const size_t open = symbol.find('(');
+                const size_t plus = symbol.find('+', open);
+                if (open != std::string::npos && plus != std::string::npos && plus > open + 1)
+                    name = demangle(symbol.substr(open + 1, plus - open - 1));
+            }
+#endif
+            if (name.empty())
+            {
+                std::ostringstream address;
+                address << frames[i];
+                name = address.str();
             }
+            names.push_back(std::move(name));
         }
+        return names;
+    }
+
+    static std::string demangle(const std::string& mangled)
+    {
+#if POOL_HAVE_CXXABI
+        int status = 0;
+        std::unique_ptr<char, void (*)(void*)> demangled(
+            abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status), std::free);
+        if (status == 0 && demangled)
+            return demangled.get();
+#endif
+        return mangled;
+    }
+
+    size_t m_sampleEvery;
+    size_t m_countdown;
+    std::map<std::vector<void*>, size_t> m_stackIds;
+    std::vector<Stack> m_stacks;
+    std::unordered_map<const void*, size_t> m_live;  // Sampled live object to its stack.
+    std::array<uint32_t, FilterSize> m_filter{};     // Live samples per hash slot.
+};
+
+// Growth policies decide the size of each new block a Pool allocates. The pool
+// calls next_block_size(lastBlockSize, capacity) when it runs out of space and
+// caps the result at its MaxBlockSize.
+
+// Grow each block by a fixed factor over the last one.
+template <size_t Factor>
+struct GeometricGrowth
+{
+    size_t next_block_size(size_t lastBlockSize, size_t /*capacity*/) const
+    {
+        return Factor * lastBlockSize;
+    }
+};
+
+// Size each block to hold about TargetMicros worth of allocations at the rate
+// observed since the previous block was added: the previous block was used up
+// in that time. A quiet period lowers the rate and so shrinks the next block;
+// a burst raises it. Blocks never exceed the pool's current capacity, which at
+// that point is the live count, so idle memory stays below half the total.
+template <size_t TargetMicros = 10000, size_t MinBlockSize = 8>
+class AdaptiveGrowth
+{
+public:
+    size_t next_block_size(size_t lastBlockSize, size_t capacity)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const double elapsed = std::chrono::duration<double, std::micro>(now - m_lastGrowth).count();
+        m_lastGrowth = now;
+
+        const double perMicro = static_cast<double>(lastBlockSize) / std::max(elapsed, 1.0);
+        const double target = std::min(perMicro * TargetMicros, static_cast<double>(std::max(capacity, MinBlockSize)));
+        return std::max(static_cast<size_t>(target), MinBlockSize);
     }
 
 private:
-    [[nodiscard]] pointer allocate()
+    std::chrono::steady_clock::time_point m_lastGrowth = std::chrono::steady_clock::now();
+};
+
+// Blocks given up by pools, kept for reuse so that a pool growing shortly after
+// another one shrank takes a block from here instead of the upstream allocator.
+// Blocks are looked up by byte size: a request is served by a cached block at
+// most a quarter larger. The cache holds at most maxBytes, dropping the oldest
+// blocks first, and frees blocks older than maxAge whenever it is used. Safe to
+// share between threads. Attach it with Pool::set_block_cache() or
+// Multipool::set_block_cache(); it must outlive the pools using it.
+class BlockCache
+{
+public:
+    explicit BlockCache(size_t maxBytes = size_t(64) << 20,
+                        std::chrono::milliseconds maxAge = std::chrono::seconds(1))
+        : m_maxBytes(maxBytes)
+        , m_maxAge(maxAge)
+    {}
+
+    ~BlockCache() { clear(); }
+
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    // A process-wide cache. Never destroyed, so pools may give blocks back to it
+    // while static objects are being destroyed.
+    static BlockCache& shared()
     {
-        // Out of space - allocate new block!
-        if (m_nextFree == nullptr)
+        static BlockCache* cache = new BlockCache();
+        return *cache;
+    }
+
+    // Take a cached block of at least `bytes` bytes aligned to `align`, setting
+    // size to its actual size, or return nullptr. Its contents are undefined.
+    [[nodiscard]] void* take(size_t bytes, size_t align, size_t& size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        evict(std::chrono::steady_clock::now());
+
+        for (auto it = m_bySize.lower_bound(bytes); it != m_bySize.end() && it->first <= bytes + bytes / 4; ++it)
         {
-            // Grow blocks sizes by the growth factor each time.
-            // Do not allow the block size to be greater than the max block size.
-            m_blockSize = std::min(GrowthFactor * m_blockSize, MaxBlockSize);
+            if (it->second->m_align < align)
+                continue;
 
-            if constexpr (DEBUG_PRINT)
-            {
-                std::cout << "Allocating " << sizeof(Item) << " (obj size) * "
-                          << m_blockSize << " (block size) = "
-                          << sizeof(Item) * m_blockSize << " bytes\n";
-            }
+            void* block = it->second->m_block;
+            size = it->first;
+            m_bytes -= size;
+            m_byAge.erase(it->second);
+            m_bySize.erase(it);
+            ++m_hits;
+            return block;
+        }
 
-            auto& newBlock = m_blocks.emplace_back(std::make_unique<Item[]>(m_blockSize));
-            for (size_t i = 1; i < m_blockSize; ++i)
-                newBlock[i-1].m_next = &newBlock[i];
+        ++m_misses;
+        return nullptr;
+    }
 
-            m_nextFree = &newBlock[0];
+    // Keep a block allocated with std::malloc or a relative for reuse. Blocks
+    // larger than the whole cache are freed at once.
+    void put(void* block, size_t bytes, size_t align)
+    {
+        if (bytes > m_maxBytes)
+        {
+            std::free(block);
+            return;
         }
 
-        Item* freeItem = m_nextFree;
-        m_nextFree = freeItem->m_next;
-        return std::launder(reinterpret_cast<pointer>(&freeItem->m_storage));
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_byAge.push_back({block, bytes, align, now});
+        m_bySize.emplace(bytes, std::prev(m_byAge.end()));
+        m_bytes += bytes;
+        evict(now);
     }
 
-    void deallocate(pointer p) noexcept
+    // Free every cached block.
+    void clear()
     {
-        Item* item = reinterpret_cast<Item*>(p);
-        item->m_next = m_nextFree;
-        m_nextFree = item;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Entry& entry : m_byAge)
+            std::free(entry.m_block);
+        m_byAge.clear();
+        m_bySize.clear();
+        m_bytes = 0;
     }
 
-    union Item
+    // Bytes currently cached.
+    size_t bytes() const
     {
-        std::aligned_storage_t<sizeof(T), alignof(T)> m_storage;
-        Item* m_next;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_bytes;
+    }
+
+    // Number of take() calls that found a block, and that didn't.
+    size_t hits() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
+    }
+
+    size_t misses() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
 
-        Item() : m_next(nullptr) {}
+private:
+    struct Entry
+    {
+        void* m_block;
+        size_t m_bytes;
+        size_t m_align;
+        std::chrono::steady_clock::time_point m_retired;
     };
 
-    std::vector<std::unique_ptr<Item[]>> m_blocks;
-    size_t m_blockSize;
-    Item* m_nextFree;
+    // Free the oldest blocks while the cache is over its size, or they are over
+    // their age.
+    void evict(std::chrono::steady_clock::time_point now)
+    {
+        while (!m_byAge.empty() && (m_bytes > m_maxBytes || now - m_byAge.front().m_retired > m_maxAge))
+        {
+            const Entry& oldest = m_byAge.front();
+            auto [first, last] = m_bySize.equal_range(oldest.m_bytes);
+            for (auto it = first; it != last; ++it)
+            {
+                if (it->second == m_byAge.begin())
+                {
+                    m_bySize.erase(it);
+                    break;
+                }
+            }
+
+            std::free(oldest.m_block);
+            m_bytes -= oldest.m_bytes;
+            m_byAge.pop_front();
+        }
+    }
+
+    size_t m_maxBytes;
+    std::chrono::milliseconds m_maxAge;
+    mutable std::mutex m_mutex;
+    std::list<Entry> m_byAge;  // Oldest first.
+    std::multimap<size_t, std::list<Entry>::iterator> m_bySize;
+    size_t m_bytes = 0;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
 };
 
-// Given a list of types, the Multipool stores a tuple of Pools of all given types.
-// Request objects of any type in the given type list from the pool, and the Multipool
-// will dispatch that request to the relevant pool. This is helpful if all types that
-// need pooling are known at compile time, and avoids wasted memory by sizing member
-// pools to the objects exactly.
-template <typename ...Ts>
-class Multipool
+// An object pool for a particular type. Stores blocks of memory to be doled
+// out as requested via the construct function. The destroy function frees the
+// given memory and allows memory reuse. When a memory block is exhausted, the
+// pool allocates a new block whose size is chosen by the Growth policy: by
+// default GrowthFactor times the last, up to MaxBlockSize. Destroying pointers
+// takes O(1) time. The release function allows the user to return all memory to
+// the upstream allocator without running destructors.
+// The free list spans all blocks managed by the pool. Slots that have never been
+// handed out are not threaded onto the free list; they are carved from the
+// current block in order when the free list is empty.
+//
+// mark() and rollback() layer a stack allocator on top: everything constructed
+// after a mark can be discarded at once, in time proportional to the number of
+// blocks touched (plus the objects destroyed, if destructors are run).
+//
+// allocate_contiguous() hands out short arrays of adjacent slots from a single
+// block. Freed arrays are kept in per-length free lists (up to
+// MaxContiguousRun slots), so finding a fit takes a bounded number of steps.
+//
+// construct_near() places an object close to a related one (a child near its
+// parent) by probing the head of the free list for a slot on the same page.
+//
+// destroy_deferred() queues objects whose destructors are expensive; drain()
+// destroys them in a batch and splices their slots onto the free list at once.
+//
+// Blocks are allocated zeroed, so construct_zeroed() only has to clear slots
+// that are being reused.
+//
+// recycle() and acquire() keep objects constructed between uses, in the style of
+// a slab cache. trim() destroys them and returns blocks with no live objects.
+// decommit() goes further for blocks that can't be freed, releasing the pages
+// behind runs of free slots while keeping the blocks.
+//
+// merge() takes over another pool's blocks, live objects and free slots without
+// moving any object; steal_free() moves empty blocks out into a new pool.
+//
+// With a BlockCache attached, blocks the pool gives up go to the cache, and new
+// blocks come from it when it has one of about the right size. reset() keeps
+// the blocks instead and starts carving from the first one again.
+template <typename T, size_t GrowthFactor = 2, size_t MaxBlockSize = 1024,
+          typename Growth = GeometricGrowth<GrowthFactor>, typename Observer = PoolObserver>
+class Pool
 {
 public:
-    Multipool(size_t n)
-        : pools(Pool<Ts>{n}...)
-    {}
+    using type = T;
+    using pointer = T*;
 
-    // Create a T* from a pool. Allocates a new block from the upstream allocator if necessary.
-    template <typename T, typename ...Args>
-    auto construct(Args&& ...args)
+    // Identifies a scope opened by mark().
+    using Checkpoint = size_t;
+
+    // Longest run of slots kept on its own free list by deallocate_contiguous().
+    static constexpr size_t MaxContiguousRun = 16;
+
+    // How many free list entries construct_near() examines for a slot near its hint.
+    static constexpr size_t NearProbeLength = 16;
+
+    // Page size assumed by construct_near() and decommit().
+    static constexpr size_t PageSize = 4096;
+
+    Pool(size_t size = 1, Observer observer = Observer())
+        : Pool(EmptyTag(), size, std::move(observer))
     {
-        return std::get<Pool<T>>(pools).construct(std::forward<Args>(args)...);
+        assert(size > 0); // Pool must hold at least one object to start.
+        assert(size <= MaxBlockSize); // Block must not exceed max block size.
+
+        add_block(size);
     }
 
-    // Destroys the given T* and deallocates its memory from the relevant pool.
-    template <typename T>
-    void destroy(T* p)
+    // Non-copyable
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Movable
+    Pool(Pool&&) = default;
+    // Releases this pool's blocks as release() does, then takes over other's
+    // blocks, objects and observer, leaving other empty.
+    Pool& operator=(Pool&& other)
     {
-        std::get<Pool<T>>(pools).destroy(p);
+        if (&other == this)
+            return *this;
+
+        release();
+        m_blocks = std::move(other.m_blocks);
+        m_growth = std::move(other.m_growth);
+        m_blockSize = other.m_blockSize;
+        m_capacity = other.m_capacity;
+        m_live = other.m_live;
+        m_blockCount = other.m_blockCount;
+        m_nextFree = other.m_nextFree;
+        m_freeTail = other.m_freeTail;
+        m_carveBlock = other.m_carveBlock;
+        m_carveNext = other.m_carveNext;
+        m_carveEnd = other.m_carveEnd;
+        m_carvePristine = other.m_carvePristine;
+        m_runs = other.m_runs;
+        m_runMask = other.m_runMask;
+        m_checkpoints = std::move(other.m_checkpoints);
+        m_deferred = std::move(other.m_deferred);
+        m_recycled = std::move(other.m_recycled);
+        m_decommitted = std::move(other.m_decommitted);
+        m_blockCache = other.m_blockCache;
+        m_observer = std::move(other.m_observer);
+        other.forget_blocks();
+        return *this;
     }
 
-    // Deallocates all backing memory for the given pool type. Does not run destructors!
-    template <typename T>
-    void release()
+    // Recycled objects belong to the pool, so their destructors run here. Live
+    // objects are not destroyed.
+    ~Pool()
     {
-        std::get<Pool<T>>(pools).release();
+        drain();
+        destroy_recycled();
+        for (Block& block : m_blocks)
+            retire(block);
     }
 
-    // Deallocates all backing memory for all pools. Does not run destructors!
-    void release_all()
+    template <typename ...Ts>
+    [[nodiscard]] pointer construct(Ts&& ...args)
     {
-        std::apply([](auto&& ...pool){((pool.release()), ...);}, pools);
+        return constructed(new (allocate()) type(std::forward<Ts>(args)...));
     }
 
-    template <typename T>
-    Pool<T>& get()
+    void destroy(pointer p)
     {
-        return std::get<Pool<T>>(pools);
+        if (p == nullptr)
+            return;
+
+        m_observer.on_destroy(p);
+        p->~type();
+        deallocate(p);
     }
 
-    Multipool(const Multipool&) = delete;
-    Multipool(Multipool&&) = delete;
-    Multipool& operator=(Multipool&&) = delete;
-    Multipool& operator=(const Multipool&) = delete;
+    Observer& observer() { return m_observer; }
+    const Observer& observer() const { return m_observer; }
 
-private:
-    std::tuple<Pool<Ts>...> pools;
-};
+    // Give blocks up to `cache`, and take new ones from it first, or stop if it
+    // is null. The cache must outlive the pool.
+    void set_block_cache(BlockCache* cache)
+    {
+        m_blockCache = cache;
+    }
+
+    // Create a T whose bytes are all zero, like a value-initialized trivial type.
+    // Slots that have never been handed out are known to be zero already, since
+    // blocks start out zeroed, so only reused slots need clearing.
+    [[nodiscard]] pointer construct_zeroed()
+    {
+        static_assert(std::is_trivially_default_constructible_v<type>, "zeroed objects must not need a constructor");
 
+        Item* item = m_nextFree;
+        if (item != nullptr)
+        {
+            m_nextFree = item->m_next;
+            m_live += 1;
+            std::memset(item, 0, sizeof(Item));
+            return constructed(new (&item->m_storage) type);
+        }
+
+        // carve() falls back to free arrays and decommitted slots only when it can't carve.
+        const bool fresh = m_carveNext != m_carveEnd || m_carveBlock + 1 < m_blocks.size()
+            || (m_runMask == 0 && (m_decommitted.empty() || !m_checkpoints.empty()));
+        item = carve();
+        m_live += 1;
+        if (!fresh || item < m_carvePristine)
+            std::memset(item, 0, sizeof(Item));
+
+        return constructed(new (&item->m_storage) type);
+    }
+
+    // Queue p to be destroyed by the next drain() instead of now, keeping an
+    // expensive destructor off the caller's path. p stays live until then.
+    void destroy_deferred(pointer p)
+    {
+        if (p != nullptr)
+            m_deferred.push_back(p);
+    }
+
+    // Run the destructors of every object queued by destroy_deferred() and put
+    // their slots back on the free list in one splice.
+    void drain()
+    {
+        if (m_deferred.empty())
+            return;
+
+        // Destructors may queue more objects; those wait for the next drain().
+        std::vector<pointer> batch;
+        batch.swap(m_deferred);
+
+        for (pointer p : batch)
+        {
+            m_observer.on_destroy(p);
+            p->~type();
+        }
+        m_live -= batch.size();
+
+        if (!m_checkpoints.empty())
+        {
+            for (pointer p : batch)
+                free_slots(reinterpret_cast<Item*>(p), 1);
+        }
+        else
+        {
+            Item* first = reinterpret_cast<Item*>(batch.front());
+            Item* last = first;
+            for (size_t i = 1; i < batch.size(); ++i)
+            {
+                Item* item = reinterpret_cast<Item*>(batch[i]);
+                last->m_next = item;
+                last = item;
+            }
+            push_free(first, last);
+        }
+
+        // Keep the queue's storage for reuse.
+        if (m_deferred.empty())
+        {
+            batch.clear();
+            m_deferred.swap(batch);
+        }
+    }
+
+    // Create a T* close to `hint`, an object from this pool, when a nearby slot
+    // is cheap to find: a free slot on the same page among the first
+    // NearProbeLength entries of the free list, or else the next never-used slot
+    // if hint lives in the block being carved. Otherwise behaves like construct().
+    template <typename ...Ts>
+    [[nodiscard]] pointer construct_near(const type* hint, Ts&& ...args)
+    {
+        return constructed(new (allocate_near(hint)) type(std::forward<Ts>(args)...));
+    }
+
+    // Return a constructed object to the pool without destroying it, so a later
+    // acquire() can hand it out again. Its destructor runs on trim() or release().
+    void recycle(pointer p)
+    {
+        if (p != nullptr)
+            m_recycled.push_back(p);
+    }
+
+    // Hand out a recycled object after calling reset(T&) on it, or construct a
+    // new one from args if there is none. Suits types that are expensive to
+    // construct but cheap to reset.
+    template <typename Reset, typename ...Ts>
+    [[nodiscard]] pointer acquire(Reset&& reset, Ts&& ...args)
+    {
+        if (m_recycled.empty())
+            return construct(std::forward<Ts>(args)...);
+
+        pointer p = m_recycled.back();
+        m_recycled.pop_back();
+        reset(*p);
+        return p;
+    }
+
+    // Destroy the recycled objects, then return every block that holds no live
+    // objects to the upstream allocator. The remaining free slots are relinked
+    // in address order, so reuse starts from the lowest addresses. Free arrays
+    // are split back into single slots. No scope may be open.
+    void trim()
+    {
+        assert(m_checkpoints.empty()); // Blocks may not move under an open scope.
+        drain();
+        destroy_recycled();
+
+        // Decommitted slots count as free when deciding which blocks to keep,
+        // but stay off the free list.
+        const FreeMap freeMap = free_map();
+        const FreeMap listed = free_map(false);
+
+        // Blocks past the carve block were never used, and the carve block goes
+        // too if every slot carved from it is free.
+        std::vector<bool> keep(m_blocks.size(), true);
+        for (size_t b = 0; b < m_blocks.size(); ++b)
+            keep[b] = !all_free(freeMap, b);
+
+        for (Block& block : remove_blocks(listed, keep))
+            retire(block);
+    }
+
+    // Add other's blocks and free slots to this pool in time proportional to the
+    // number of blocks, leaving other empty. Live objects stay where they are and
+    // are owned by this pool from now on. Other's free list is spliced on whole;
+    // its free arrays are relinked one by one. Each block changing hands is
+    // reported to other's observer as released and to this pool's as grown; the
+    // live objects in them are not reported. Neither pool may have a scope open.
+    void merge(Pool&& other)
+    {
+        assert(m_checkpoints.empty() && other.m_checkpoints.empty()); // Scopes pin block order.
+        if (&other == this || other.m_blocks.empty())
+            return;
+
+        // Blocks stay ordered as carving expects: fully carved blocks first, then
+        // this pool's carve block and the blocks after it. Other's carve block
+        // counts as fully carved; its never-used end is kept as free slots off
+        // the free list.
+        const size_t otherCarved = std::min(other.m_carveBlock, other.m_blocks.size());
+        if (other.m_carveBlock < other.m_blocks.size())
+        {
+            other.set_carve(other.m_carveBlock, other.carve_offset()); // Brings m_dirty up to date.
+            if (other.m_carveNext != other.m_carveEnd)
+            {
+                // Handed out from the list, those slots get dirty without
+                // carving, so none of the block counts as zero any more.
+                m_decommitted.emplace_back(other.m_carveNext, other.m_carveEnd - other.m_carveNext);
+                Block& carveBlock = other.m_blocks[other.m_carveBlock];
+                carveBlock.m_dirty = carveBlock.m_size;
+            }
+        }
+        const size_t adopted = otherCarved + (other.m_carveBlock < other.m_blocks.size() ? 1 : 0);
+
+        for (const Block& block : other.m_blocks)
+        {
+            other.m_observer.on_release(block.m_items.get(), block.m_size, block.m_size * sizeof(Item));
+            m_observer.on_grow(block.m_items.get(), block.m_size, block.m_size * sizeof(Item));
+        }
+
+        const size_t firstMoved = std::min(m_carveBlock, m_blocks.size());
+        std::vector<Block> blocks;
+        blocks.reserve(m_blocks.size() + other.m_blocks.size());
+        std::move(m_blocks.begin(), m_blocks.begin() + firstMoved, std::back_inserter(blocks));
+        std::move(other.m_blocks.begin(), other.m_blocks.begin() + adopted, std::back_inserter(blocks));
+        std::move(m_blocks.begin() + firstMoved, m_blocks.end(), std::back_inserter(blocks));
+        std::move(other.m_blocks.begin() + adopted, other.m_blocks.end(), std::back_inserter(blocks));
+        m_blocks = std::move(blocks);
+        m_carveBlock += adopted;
+        if (m_carveNext == nullptr)
+        {
+            // This pool had no blocks. With no never-used block after the
+            // adopted ones, carve on from the end of the last, as trim() does.
+            if (m_carveBlock < m_blocks.size())
+                set_carve(m_carveBlock, 0);
+            else
+                set_carve(m_blocks.size() - 1, m_blocks.back().m_size);
+        }
+
+        if (other.m_nextFree != nullptr)
+            push_free(other.m_nextFree, other.m_freeTail);
+
+        for (uint32_t mask = other.m_runMask; mask != 0; mask &= mask - 1)
+        {
+            const size_t length = __builtin_ctz(mask);
+            for (Item* run = other.m_runs[length]; run != nullptr;)
+            {
+                Item* next = run->m_next;
+                free_run(run, length);
+                run = next;
+            }
+        }
+
+        m_decommitted.insert(m_decommitted.end(), other.m_decommitted.begin(), other.m_decommitted.end());
+        m_deferred.insert(m_deferred.end(), other.m_deferred.begin(), other.m_deferred.end());
+        m_recycled.insert(m_recycled.end(), other.m_recycled.begin(), other.m_recycled.end());
+        m_capacity += other.m_capacity;
+        m_live += other.m_live;
+        m_blockCount += other.m_blockCount;
+
+        other.forget_blocks();
+    }
+
+    // Move blocks with no live objects into a new pool until it holds at least n
+    // slots or no such blocks are left, e.g. to hand spare capacity to another
+    // thread. Never-used blocks go first; finding blocks that were used costs a
+    // walk of the free lists, after which the free list is relinked as by trim().
+    // The blocks are reported to the observers as by merge(). No scope may be open.
+    [[nodiscard]] Pool steal_free(size_t n)
+    {
+        assert(m_checkpoints.empty()); // Blocks may not move under an open scope.
+        drain();
+
+        std::vector<bool> keep(m_blocks.size(), true);
+        size_t stolen = 0;
+        for (size_t b = m_blocks.size(); b-- > m_carveBlock + 1 && stolen < n;)
+        {
+            keep[b] = false;
+            stolen += m_blocks[b].m_size;
+        }
+
+        std::vector<Block> blocks;
+        if (stolen < n)
+        {
+            const FreeMap freeMap = free_map();
+            for (size_t b = 0; b < m_carveBlock && stolen < n; ++b)
+            {
+                if (all_free(freeMap, b))
+                {
+                    keep[b] = false;
+                    stolen += m_blocks[b].m_size;
+                }
+            }
+            blocks = remove_blocks(free_map(false), keep);
+        }
+        else
+        {
+            // Only never-used blocks go, so the free list is untouched.
+            for (size_t b = 0; b < m_blocks.size(); ++b)
+                if (!keep[b])
+                    blocks.push_back(std::move(m_blocks[b]));
+            m_blocks.resize(m_blocks.size() - blocks.size());
+            m_capacity -= stolen;
+            m_blockCount -= blocks.size();
+        }
+
+        Pool pool(EmptyTag(), m_blockSize);
+        pool.m_blockCache = m_blockCache;
+        for (Block& block : blocks)
+        {
+            m_observer.on_release(block.m_items.get(), block.m_size, block.m_size * sizeof(Item));
+            pool.m_observer.on_grow(block.m_items.get(), block.m_size, block.m_size * sizeof(Item));
+            pool.m_capacity += block.m_size;
+            pool.m_blockCount += 1;
+            pool.m_blocks.push_back(std::move(block));
+        }
+        pool.set_carve(0, 0);
+        return pool;
+    }
+
+    // Give the memory behind every whole page of free slots back to the OS with
+    // madvise(MADV_DONTNEED), while keeping the blocks. Those slots leave the
+    // free list and are only handed out again once the free list and the
+    // current block are exhausted, at which point their pages are faulted back
+    // in one at a time. Unused pages at the end of the carve block and beyond are
+    // released too. Returns the number of bytes released. No scope may be open.
+    size_t decommit()
+    {
+        assert(m_checkpoints.empty()); // Scopes stash free lists that may point into released pages.
+        drain();
+
+        size_t released = 0;
+#if POOL_HAVE_MADVISE
+        FreeMap freeMap = free_map();
+        m_decommitted.clear();
+
+        auto release_pages = [&released](uintptr_t first, uintptr_t last) {
+            if (first < last && madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED) == 0)
+                released += last - first;
+        };
+
+        for (size_t b = 0; b < m_blocks.size(); ++b)
+        {
+            Item* items = m_blocks[b].m_items.get();
+            const size_t carved = carved_in(b);
+            const uintptr_t start = reinterpret_cast<uintptr_t>(items);
+            uint64_t* words = &freeMap.m_words[freeMap.m_firstWord[b]];
+            auto is_free = [words](size_t i) { return (words[i / 64] >> (i % 64)) & 1; };
+
+            // Runs of whole pages in the carved part whose slots are all free.
+            // A run's range includes the slots straddling its edges.
+            uintptr_t runStart = 0;
+            size_t runFirstSlot = 0;
+            size_t runEndSlot = 0;
+            auto end_run = [&](uintptr_t runEnd) {
+                if (runStart == 0)
+                    return;
+
+                release_pages(runStart, runEnd);
+                m_decommitted.emplace_back(items + runFirstSlot, runEndSlot - runFirstSlot);
+                for (size_t i = runFirstSlot; i < runEndSlot; ++i)
+                    words[i / 64] &= ~(uint64_t(1) << (i % 64));
+                runStart = 0;
+            };
+
+            const uintptr_t carvedEnd = start + carved * sizeof(Item);
+            uintptr_t page = (start + PageSize - 1) / PageSize * PageSize;
+            for (; page + PageSize <= carvedEnd; page += PageSize)
+            {
+                const size_t first = (page - start) / sizeof(Item);
+                const size_t end = (page + PageSize - start + sizeof(Item) - 1) / sizeof(Item);
+                bool allFree = true;
+                for (size_t i = first; i < end && allFree; ++i)
+                    allFree = is_free(i);
+
+                if (!allFree)
+                {
+                    end_run(page);
+                    continue;
+                }
+
+                if (runStart == 0)
+                {
+                    runStart = page;
+                    runFirstSlot = first;
+                }
+                runEndSlot = end;
+            }
+            end_run(page);
+
+            // Never-carved slots need no bookkeeping: released pages read back as zero.
+            const uintptr_t uncarved = (carvedEnd + PageSize - 1) / PageSize * PageSize;
+            release_pages(uncarved, (start + m_blocks[b].m_size * sizeof(Item)) / PageSize * PageSize);
+        }
+
+        relink_free(freeMap, std::vector<bool>(m_blocks.size(), true));
+#endif
+        return released;
+    }
+
+    // Discard every object but keep the blocks, so that the pool fills up again
+    // from its first block without growing. Costs one step per block: no slot is
+    // touched until it is carved again. Destructors run only for recycled
+    // objects, and for the live ones too if runDestructors is set (a walk of
+    // every block). Deferred destructions are drained. Open scopes are closed.
+    void reset(bool runDestructors = false)
+    {
+        drain();
+        destroy_recycled();
+        if constexpr (!std::is_trivially_destructible_v<type>)
+        {
+            if (runDestructors)
+            {
+                for_each_live(free_map(), [](Item* item) {
+                    std::launder(reinterpret_cast<pointer>(&item->m_storage))->~type();
+                });
+            }
+        }
+        m_observer.on_discard([](const void*) { return true; });
+
+        m_live = 0;
+        m_nextFree = nullptr;
+        clear_runs();
+        m_checkpoints.clear();
+        m_deferred.clear();
+        m_decommitted.clear();
+        set_carve(0, 0);
+    }
+
+    // Deallocate every block! Doesn't run destructors, except those of deferred
+    // and recycled objects.
+    void release()
+    {
+        drain();
+        destroy_recycled();
+        m_observer.on_discard([](const void*) { return true; });
+        for (Block& block : m_blocks)
+            retire(block);
+
+        forget_blocks();
+    }
+
+    // Hand free slots from one pool to another, e.g. between thread caches,
+    // without counting them live in either: detach_free() takes a slot off the
+    // free list (carving or growing if need be) and attach_free(p) puts one on.
+    // disown(n) stops counting n live slots that were freed into another pool.
+    // A slot stays in the block it came from, which must outlive its use.
+    [[nodiscard]] pointer detach_free()
+    {
+        pointer p = allocate();
+        m_live -= 1;
+        return p;
+    }
+
+    void attach_free(pointer p) noexcept
+    {
+        deallocate(p);
+        m_live += 1;
+    }
+
+    void disown(size_t n) noexcept
+    {
+        m_live -= n;
+    }
+
+    // Returns uninitialized storage for an array of n objects, taken from a
+    // single block. Must be returned with deallocate_contiguous(p, n).
+    [[nodiscard]] pointer allocate_contiguous(size_t n)
+    {
+        assert(n > 0);
+        const size_t slots = slots_for(n);
+        assert(slots <= MaxBlockSize); // Array must fit in a single block.
+
+        if (slots == 1)
+            return allocate();
+
+        Item* run = take_run(slots);
+        if (run == nullptr)
+            run = carve_run(slots);
+        m_live += slots;
+
+        return std::launder(reinterpret_cast<pointer>(&run->m_storage));
+    }
+
+    // Returns storage from allocate_contiguous(n). Doesn't run destructors.
+    void deallocate_contiguous(pointer p, size_t n) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        free_slots(reinterpret_cast<Item*>(p), slots_for(n));
+        m_live -= slots_for(n);
+    }
+
+    // Open a scope: everything constructed from now until the matching rollback()
+    // can be discarded in one go, or kept with commit(). Deferred destructions
+    // are drained first. Within the scope, objects are placed in slots that were
+    // never used before the mark or that were freed within the scope. Objects
+    // constructed before the mark may be destroyed in the scope; their slots are
+    // set aside until it closes. Scopes nest.
+    [[nodiscard]] Checkpoint mark()
+    {
+        drain();
+        Saved& saved = m_checkpoints.emplace_back();
+        saved.m_nextFree = m_nextFree;
+        saved.m_freeTail = m_freeTail;
+        saved.m_carveBlock = m_carveBlock;
+        saved.m_carveOffset = carve_offset();
+        saved.m_runMask = m_runMask;
+        saved.m_live = m_live;
+        if (m_runMask != 0)
+            saved.m_runs = m_runs;
+
+        m_nextFree = nullptr;
+        clear_runs();
+        return m_checkpoints.size() - 1;
+    }
+
+    // Discard every object constructed since `checkpoint` was marked, and close
+    // that scope along with any scopes nested inside it. Destructors of the
+    // discarded objects are run unless runDestructors is false.
+    void rollback(Checkpoint checkpoint, bool runDestructors = true)
+    {
+        assert(checkpoint < m_checkpoints.size()); // Scope must still be open.
+        drain();
+        const Saved saved = m_checkpoints[checkpoint];
+
+        m_observer.on_discard([this, &saved](const void* p) {
+            return carved_since(saved, static_cast<const Item*>(p));
+        });
+
+        // Recycled objects constructed in the scope are discarded with it.
+        m_recycled.erase(std::remove_if(m_recycled.begin(), m_recycled.end(), [this, &saved](pointer p) {
+            return carved_since(saved, reinterpret_cast<const Item*>(p));
+        }), m_recycled.end());
+
+        if constexpr (!std::is_trivially_destructible_v<type>)
+        {
+            if (runDestructors)
+                destroy_since(checkpoint);
+        }
+
+        m_nextFree = saved.m_nextFree;
+        m_freeTail = saved.m_freeTail;
+        m_live = saved.m_live;
+        set_carve(saved.m_carveBlock, saved.m_carveOffset);
+        clear_runs();
+        if (saved.m_runMask != 0)
+        {
+            m_runs = saved.m_runs;
+            m_runMask = saved.m_runMask;
+        }
+        m_checkpoints.resize(checkpoint);
+    }
+
+    // Close the scope opened at `checkpoint`, and any scopes nested inside it,
+    // keeping every object constructed in them. The free slots set aside by
+    // their marks become available again.
+    void commit(Checkpoint checkpoint)
+    {
+        assert(checkpoint < m_checkpoints.size()); // Scope must still be open.
+        drain();
+
+        std::vector<std::pair<Item*, size_t>> stashed;
+        for (size_t i = checkpoint; i < m_checkpoints.size(); ++i)
+        {
+            const Saved& saved = m_checkpoints[i];
+            for (Item* item = saved.m_nextFree; item != nullptr; item = item->m_next)
+                stashed.emplace_back(item, 1);
+            for (uint32_t mask = saved.m_runMask; mask != 0; mask &= mask - 1)
+            {
+                const size_t length = __builtin_ctz(mask);
+                for (Item* run = saved.m_runs[length]; run != nullptr; run = run->m_next)
+                    stashed.emplace_back(run, length);
+            }
+        }
+        m_checkpoints.resize(checkpoint);
+
+        // Slots that predate an enclosing scope are set aside for it in turn.
+        for (const auto& [first, slots] : stashed)
+            free_slots(first, slots);
+    }
+
+    bool full() const
+    {
+        return m_nextFree == nullptr && m_carveNext == m_carveEnd && m_carveBlock + 1 >= m_blocks.size()
+            && m_runMask == 0 && m_decommitted.empty();
+    }
+
+    // Number of objects the pool's blocks can hold.
+    size_t capacity() const { return m_capacity; }
+
+    // Size counters, which may be read while another thread uses the pool.
+    PoolStats stats() const
+    {
+        return { m_capacity.load(), m_live.load(), m_blockCount.load(), sizeof(Item) };
+    }
+
+    // Calls f(T&) for every live object, in block order. Costs one walk of the
+    // free lists plus a scan of the blocks.
+    template <typename F>
+    void visit_live(F&& f)
+    {
+        for_each_live(free_map(), [&f](Item* item) {
+            f(*std::launder(reinterpret_cast<pointer>(&item->m_storage)));
+        });
+    }
+
+    void print() const
+    {
+        size_t freeCount = 0;
+        Item* itemPtr = m_nextFree;
+        while (itemPtr != nullptr)
+        {
+            freeCount++;
+            itemPtr = itemPtr->m_next;
+        }
+
+        std::cout << "Element size: " << sizeof(type) << "\n";
+        std::cout << "Element alignment: " << alignof(type) << "\n";
+        std::cout << "Next free: " << (void*)m_nextFree << "\n";
+        std::cout << "Block size: " << m_blockSize << "\n";
+        std::cout << "Free count: " << freeCount << "\n";
+
+        std::cout << std::hex << std::setfill('0');
+        for (auto& block : m_blocks)
+        {
+            std::cout << "\nBlock start: " << block.m_items.get() << "\n";
+            for (size_t i = 0; i < block.m_size; ++i)
+            {
+                const pointer p = std::launder(reinterpret_cast<pointer>(&block.m_items[i]));
+                const std::byte* p_bytes = reinterpret_cast<std::byte*>(p);
+                for (int j = sizeof(type) - 1; j >= 0; --j)
+                {
+                    if (j == sizeof(type) - 1)
+                        std::cout << (void*)p_bytes << ": ";
+
+                    std::cout << std::setw(2) << static_cast<unsigned>(p_bytes[j]) << " ";
+
+                    if (j == 0)
+                        std::cout << "\n";
+                }
+            }
+        }
+    }
+
+private:
+    union Item
+    {
+        std::aligned_storage_t<sizeof(T), alignof(T)> m_storage;
+        Item* m_next;
+    };
+
+    struct FreeBlock
+    {
+        void operator()(Item* items) const noexcept { std::free(items); }
+    };
+
+    // Blocks start out zeroed. Slots from m_dirty on have never been handed out
+    // and are still zero; m_dirty is brought up to date when carving leaves the block.
+    struct Block
+    {
+        std::unique_ptr<Item[], FreeBlock> m_items;
+        size_t m_size;
+        size_t m_dirty;
+    };
+
+    // Free runs of adjacent slots, indexed by length. The first slot of each run
+    // links to the next run of the same length.
+    using RunLists = std::array<Item*, MaxContiguousRun + 1>;
+    static_assert(MaxContiguousRun < 32, "run lengths are tracked in a 32-bit mask");
+
+    // Allocation state saved by mark(). m_runs is only meaningful for the
+    // lengths set in m_runMask.
+    struct Saved
+    {
+        Saved() {} // Leaves m_runs uninitialized.
+
+        Item* m_nextFree;
+        Item* m_freeTail;
+        size_t m_carveBlock;
+        size_t m_carveOffset;
+        uint32_t m_runMask;
+        size_t m_live;
+        RunLists m_runs;
+    };
+
+    pointer constructed(pointer p)
+    {
+        m_observer.on_construct(p);
+        return p;
+    }
+
+    [[nodiscard]] pointer allocate()
+    {
+        Item* freeItem = m_nextFree;
+        if (freeItem != nullptr)
+            m_nextFree = freeItem->m_next;
+        else
+            freeItem = carve();
+
+        m_live += 1;
+        return std::launder(reinterpret_cast<pointer>(&freeItem->m_storage));
+    }
+
+    [[nodiscard]] pointer allocate_near(const type* hint)
+    {
+        const uintptr_t page = reinterpret_cast<uintptr_t>(hint) / PageSize;
+
+        Item* prev = nullptr;
+        Item** link = &m_nextFree;
+        for (size_t i = 0; i < NearProbeLength && *link != nullptr; ++i, prev = *link, link = &(*link)->m_next)
+        {
+            Item* item = *link;
+            if (reinterpret_cast<uintptr_t>(item) / PageSize == page)
+            {
+                *link = item->m_next;
+                if (item == m_freeTail)
+                    m_freeTail = prev;
+                m_live += 1;
+                return std::launder(reinterpret_cast<pointer>(&item->m_storage));
+            }
+        }
+
+        const Item* hintItem = reinterpret_cast<const Item*>(hint);
+        if (m_carveNext != m_carveEnd && m_blocks[m_carveBlock].m_items.get() <= hintItem && hintItem < m_carveEnd)
+        {
+            m_live += 1;
+            return std::launder(reinterpret_cast<pointer>(&(m_carveNext++)->m_storage));
+        }
+
+        return allocate();
+    }
+
+    // Push the chain first..last onto the free list.
+    void push_free(Item* first, Item* last) noexcept
+    {
+        if (m_nextFree == nullptr)
+            m_freeTail = last;
+        last->m_next = m_nextFree;
+        m_nextFree = first;
+    }
+
+    void deallocate(pointer p) noexcept
+    {
+        Item* item = reinterpret_cast<Item*>(p);
+        if (m_checkpoints.empty())
+            push_free(item, item);
+        else
+            free_slots(item, 1);
+        m_live -= 1;
+    }
+
+    // Free `slots` slots from `first` on. Inside a scope, slots from before its
+    // mark are not reused by the scope: they go on the free list stashed by the
+    // outermost mark that postdates them, and count as free from that mark on.
+    void free_slots(Item* first, size_t slots) noexcept
+    {
+        if (m_checkpoints.empty() || carved_since(m_checkpoints.back(), first))
+        {
+            free_run(first, slots);
+            return;
+        }
+
+        size_t outer = m_checkpoints.size() - 1;
+        while (outer > 0 && !carved_since(m_checkpoints[outer - 1], first))
+            --outer;
+
+        Saved& saved = m_checkpoints[outer];
+        for (Item* item = first; item != first + slots; ++item)
+        {
+            if (saved.m_nextFree == nullptr)
+                saved.m_freeTail = item;
+            item->m_next = saved.m_nextFree;
+            saved.m_nextFree = item;
+        }
+        for (size_t i = outer; i < m_checkpoints.size(); ++i)
+            m_checkpoints[i].m_live -= slots;
+    }
+
+    // Take the next never-used slot, moving on to the next block when the
+    // current one is exhausted.
+    [[nodiscard]] Item* carve()
+    {
+        while (m_carveNext == m_carveEnd)
+        {
+            if (m_carveBlock + 1 < m_blocks.size())
+            {
+                set_carve(m_carveBlock + 1, 0);
+                continue;
+            }
+
+            // Split a free array before growing.
+            if (m_runMask != 0)
+                return take_run(1);
+
+            // Then reuse decommitted slots, unless a scope is open: those slots
+            // predate it.
+            if (!m_decommitted.empty() && m_checkpoints.empty())
+                return recommit();
+
+            // Out of space - allocate new block!
+            // Size the next block by the growth policy, capped at the max block size.
+            grow_block_size();
+            add_block(m_blockSize);
+        }
+
+        return m_carveNext++;
+    }
+
+    // Number of slots needed to hold an array of n objects.
+    static constexpr size_t slots_for(size_t n)
+    {
+        return (n * sizeof(type) + sizeof(Item) - 1) / sizeof(Item);
+    }
+
+    // Pop the shortest free run of at least `slots` slots, returning any excess
+    // to the free lists. Returns nullptr if there is none, which is always the
+    // case for runs longer than MaxContiguousRun.
+    Item* take_run(size_t slots) noexcept
+    {
+        if (slots > MaxContiguousRun)
+            return nullptr;
+
+        const uint32_t candidates = m_runMask & ~((uint32_t(1) << slots) - 1);
+        if (candidates == 0)
+            return nullptr;
+
+        const size_t length = static_cast<size_t>(__builtin_ctz(candidates));
+        Item* run = m_runs[length];
+        m_runs[length] = run->m_next;
+        if (m_runs[length] == nullptr)
+            m_runMask &= ~(uint32_t(1) << length);
+
+        if (length > slots)
+            free_run(run + slots, length - slots);
+
+        return run;
+    }
+
+    // Carve `slots` adjacent never-used slots from one block. The tail of a block
+    // too short to hold them is kept as a free run.
+    Item* carve_run(size_t slots)
+    {
+        while (static_cast<size_t>(m_carveEnd - m_carveNext) < slots)
+        {
+            if (m_carveNext != m_carveEnd)
+            {
+                free_run(m_carveNext, m_carveEnd - m_carveNext);
+                m_carveNext = m_carveEnd;
+            }
+
+            if (m_carveBlock + 1 < m_blocks.size())
+            {
+                set_carve(m_carveBlock + 1, 0);
+                continue;
+            }
+
+            grow_block_size();
+            add_block(std::max(m_blockSize, slots));
+        }
+
+        Item* run = m_carveNext;
+        m_carveNext += slots;
+        return run;
+    }
+
+    // Constructs a pool without blocks, whose first block will hold `size` slots.
+    struct EmptyTag {};
+    Pool(EmptyTag, size_t size, Observer observer = Observer())
+        : m_blocks()
+        , m_growth()
+        , m_blockSize(size)
+        , m_capacity(0)
+        , m_live(0)
+        , m_blockCount(0)
+        , m_nextFree(nullptr)
+        , m_freeTail(nullptr)
+        , m_carveBlock(0)
+        , m_carveNext(nullptr)
+        , m_carveEnd(nullptr)
+        , m_carvePristine(nullptr)
+        , m_runs()
+        , m_runMask(0)
+        , m_checkpoints()
+        , m_deferred()
+        , m_recycled()
+        , m_decommitted()
+        , m_blockCache(nullptr)
+        , m_observer(std::move(observer))
+    {}
+
+    // Drop every block and everything pointing into them without freeing or
+    // destroying anything, leaving the pool empty.
+    void forget_blocks() noexcept
+    {
+        m_blocks.clear();
+        m_capacity = 0;
+        m_live = 0;
+        m_blockCount = 0;
+        m_nextFree = nullptr;
+        m_carveBlock = 0;
+        m_carveNext = m_carveEnd = m_carvePristine = nullptr;
+        clear_runs();
+        m_checkpoints.clear();
+        m_deferred.clear();
+        m_recycled.clear();
+        m_decommitted.clear();
+    }
+
+    void clear_runs() noexcept
+    {
+        for (uint32_t mask = m_runMask; mask != 0; mask &= mask - 1)
+            m_runs[__builtin_ctz(mask)] = nullptr;
+
+        m_runMask = 0;
+    }
+
+    void free_run(Item* run, size_t slots) noexcept
+    {
+        for (; slots > MaxContiguousRun; slots -= MaxContiguousRun, run += MaxContiguousRun)
+            free_run(run, MaxContiguousRun);
+
+        if (slots == 1)
+        {
+            push_free(run, run);
+            return;
+        }
+
+        run->m_next = m_runs[slots];
+        m_runs[slots] = run;
+        m_runMask |= uint32_t(1) << slots;
+    }
+
+    // Pick the size of the next block.
+    void grow_block_size()
+    {
+        m_blockSize = std::clamp<size_t>(m_growth.next_block_size(m_blockSize, m_capacity), 1, MaxBlockSize);
+    }
+
+    void add_block(size_t size)
+    {
+        void* items = nullptr;
+        size_t dirty = 0;
+        if (m_blockCache != nullptr)
+        {
+            size_t bytes;
+            items = m_blockCache->take(size * sizeof(Item), block_align(), bytes);
+            if (items != nullptr)
+            {
+                // A cached block may hold anything, so no slot counts as zeroed.
+                size = bytes / sizeof(Item);
+                dirty = size;
+            }
+        }
+
+        // calloc gets large blocks as fresh pages that are already zero.
+        if (items == nullptr)
+        {
+            if constexpr (alignof(Item) > alignof(std::max_align_t))
+            {
+                const size_t bytes = (size * sizeof(Item) + alignof(Item) - 1) / alignof(Item) * alignof(Item);
+                items = std::aligned_alloc(alignof(Item), bytes);
+                if (items != nullptr)
+                    std::memset(items, 0, bytes);
+            }
+            else
+            {
+                items = std::calloc(size, sizeof(Item));
+            }
+        }
+
+        if (items == nullptr)
+        {
+            m_observer.on_out_of_memory(size * sizeof(Item));
+            throw std::bad_alloc();
+        }
+
+        m_observer.on_grow(items, size, size * sizeof(Item));
+        m_blocks.push_back({std::unique_ptr<Item[], FreeBlock>(static_cast<Item*>(items)), size, dirty});
+        m_capacity += size;
+        m_blockCount += 1;
+        set_carve(m_blocks.size() - 1, 0);
+    }
+
+    // Give a block up, to the block cache if there is one. Blocks not handed to
+    // the cache are freed along with the Block.
+    void retire(Block& block)
+    {
+        m_observer.on_release(block.m_items.get(), block.m_size, block.m_size * sizeof(Item));
+        if (m_blockCache != nullptr && block.m_items != nullptr)
+            m_blockCache->put(block.m_items.release(), block.m_size * sizeof(Item), block_align());
+    }
+
+    static constexpr size_t block_align()
+    {
+        return std::max(alignof(Item), alignof(std::max_align_t));
+    }
+
+    size_t carve_offset() const
+    {
+        return m_blocks.empty() ? 0 : m_carveNext - m_blocks[m_carveBlock].m_items.get();
+    }
+
+    void set_carve(size_t block, size_t offset)
+    {
+        if (m_carveNext != nullptr && m_carveBlock < m_blocks.size())
+        {
+            Block& current = m_blocks[m_carveBlock];
+            current.m_dirty = std::max(current.m_dirty, static_cast<size_t>(m_carveNext - current.m_items.get()));
+        }
+
+        m_carveBlock = block;
+        if (block >= m_blocks.size())
+        {
+            m_carveNext = m_carveEnd = m_carvePristine = nullptr;
+            return;
+        }
+
+        Item* items = m_blocks[block].m_items.get();
+        m_carveNext = items + offset;
+        m_carveEnd = items + m_blocks[block].m_size;
+        m_carvePristine = items + m_blocks[block].m_dirty;
+    }
+
+    // Whether item was carved after the state in `saved`.
+    bool carved_since(const Saved& saved, const Item* item) const
+    {
+        for (size_t b = saved.m_carveBlock; b <= m_carveBlock && b < m_blocks.size(); ++b)
+        {
+            const Item* begin = m_blocks[b].m_items.get() + (b == saved.m_carveBlock ? saved.m_carveOffset : 0);
+            const Item* end = b == m_carveBlock ? m_carveNext : m_blocks[b].m_items.get() + m_blocks[b].m_size;
+            if (begin <= item && item < end)
+                return true;
+        }
+        return false;
+    }
+
+    // Visit every slot freed inside the scope opened at `checkpoint`: the current
+    // free list plus the free lists stashed by nested scopes.
+    template <typename F>
+    void for_each_free_since(Checkpoint checkpoint, F&& f) const
+    {
+        for_each_free(checkpoint + 1, std::forward<F>(f));
+    }
+
+    // Visit every free slot on the current free lists and on those stashed by
+    // the scopes from `firstSaved` on, plus the decommitted slots if asked.
+    template <typename F>
+    void for_each_free(size_t firstSaved, F&& f, bool withDecommitted = false) const
+    {
+        if (withDecommitted)
+            for (const auto& [first, count] : m_decommitted)
+                for (size_t i = 0; i < count; ++i)
+                    f(first + i);
+
+        auto visit = [&f](Item* nextFree, const RunLists& runs, uint32_t runMask) {
+            for (Item* item = nextFree; item != nullptr; item = item->m_next)
+                f(item);
+
+            for (; runMask != 0; runMask &= runMask - 1)
+            {
+                const size_t length = __builtin_ctz(runMask);
+                for (Item* run = runs[length]; run != nullptr; run = run->m_next)
+                    for (size_t i = 0; i < length; ++i)
+                        f(run + i);
+            }
+        };
+
+        visit(m_nextFree, m_runs, m_runMask);
+        for (size_t i = firstSaved; i < m_checkpoints.size(); ++i)
+            visit(m_checkpoints[i].m_nextFree, m_checkpoints[i].m_runs, m_checkpoints[i].m_runMask);
+    }
+
+    // One bit per slot, set for slots on any free list. Each block's bits start
+    // on a word boundary.
+    struct FreeMap
+    {
+        std::vector<size_t> m_firstWord;
+        std::vector<uint64_t> m_words;
+    };
+
+    // Build the FreeMap by walking every free list once, and the decommitted
+    // slots unless withDecommitted is false. Finding a slot's block is a binary
+    // search over the blocks sorted by address.
+    FreeMap free_map(bool withDecommitted = true) const
+    {
+        FreeMap map;
+        std::vector<std::pair<const Item*, size_t>> starts;
+        size_t words = 0;
+        for (size_t b = 0; b < m_blocks.size(); ++b)
+        {
+            map.m_firstWord.push_back(words);
+            words += (m_blocks[b].m_size + 63) / 64;
+            starts.emplace_back(m_blocks[b].m_items.get(), b);
+        }
+        std::sort(starts.begin(), starts.end());
+        map.m_words.assign(words, 0);
+
+        for_each_free(0, [&](const Item* item) {
+            auto it = std::upper_bound(starts.begin(), starts.end(), std::make_pair(item, m_blocks.size()));
+            --it;
+            const size_t slot = item - it->first;
+            map.m_words[map.m_firstWord[it->second] + slot / 64] |= uint64_t(1) << (slot % 64);
+        }, withDecommitted);
+        return map;
+    }
+
+    // Number of slots of block b that have been carved.
+    size_t carved_in(size_t b) const
+    {
+        if (b < m_carveBlock)
+            return m_blocks[b].m_size;
+        return b == m_carveBlock ? m_carveNext - m_blocks[b].m_items.get() : 0;
+    }
+
+    // Rebuild the free list from the slots marked in freeMap, in address order so
+    // reuse starts from the lowest addresses. Blocks not kept are skipped. Free
+    // arrays are split back into single slots.
+    void relink_free(const FreeMap& freeMap, const std::vector<bool>& keep)
+    {
+        m_nextFree = nullptr;
+        clear_runs();
+        for (size_t b = m_blocks.size(); b-- > 0;)
+        {
+            if (!keep[b])
+                continue;
+
+            Item* items = m_blocks[b].m_items.get();
+            const uint64_t* words = &freeMap.m_words[freeMap.m_firstWord[b]];
+            for (size_t i = carved_in(b); i-- > 0;)
+            {
+                if (words[i / 64] & (uint64_t(1) << (i % 64)))
+                    push_free(&items[i], &items[i]);
+            }
+        }
+    }
+
+    // Remove the blocks not marked in keep, none of which may hold live objects,
+    // and return them. The free list is rebuilt from the slots marked in listed.
+    std::vector<Block> remove_blocks(const FreeMap& listed, const std::vector<bool>& keep)
+    {
+        relink_free(listed, keep);
+
+        std::vector<std::pair<const Item*, const Item*>> dropped;
+        for (size_t b = 0; b < m_blocks.size(); ++b)
+            if (!keep[b])
+                dropped.emplace_back(m_blocks[b].m_items.get(), m_blocks[b].m_items.get() + m_blocks[b].m_size);
+
+        std::sort(dropped.begin(), dropped.end());
+        m_decommitted.erase(std::remove_if(m_decommitted.begin(), m_decommitted.end(), [&dropped](const auto& range) {
+            // Find the last dropped block starting at or before the range.
+            auto it = std::upper_bound(dropped.begin(), dropped.end(), range.first, [](const Item* p, const auto& d) { return p < d.first; });
+            return it != dropped.begin() && range.first < (--it)->second;
+        }), m_decommitted.end());
+
+        std::vector<Block> removed;
+        size_t kept = 0;
+        const size_t carveBlock = m_carveBlock;
+        const bool carveRemoved = carveBlock < m_blocks.size() && !keep[carveBlock];
+        for (size_t b = 0; b < m_blocks.size(); ++b)
+        {
+            if (!keep[b])
+            {
+                m_capacity -= m_blocks[b].m_size;
+                m_blockCount -= 1;
+                if (b < carveBlock)
+                    --m_carveBlock;
+                removed.push_back(std::move(m_blocks[b]));
+            }
+            else if (kept++ != b)
+            {
+                m_blocks[kept - 1] = std::move(m_blocks[b]);
+            }
+        }
+        m_blocks.resize(kept);
+
+        // Without its carve block the pool carves on from the end of its last
+        // block, which is full, so the next carve grows it.
+        if (carveRemoved)
+        {
+            assert(m_carveBlock == m_blocks.size()); // Blocks after the carve block must go with it.
+            m_carveNext = nullptr;
+            if (m_blocks.empty())
+                set_carve(0, 0);
+            else
+                set_carve(m_blocks.size() - 1, m_blocks.back().m_size);
+        }
+        return removed;
+    }
+
+    // Hand out a slot from the last decommitted range, putting the rest of its
+    // first page's worth of slots on the free list. Touching them faults the page
+    // back in.
+    Item* recommit()
+    {
+        auto& [first, count] = m_decommitted.back();
+        const size_t n = std::min(count, std::max<size_t>(PageSize / sizeof(Item), 1));
+        Item* item = first;
+        for (size_t i = n; i-- > 1;)
+            push_free(&first[i], &first[i]);
+
+        first += n;
+        count -= n;
+        if (count == 0)
+            m_decommitted.pop_back();
+        return item;
+    }
+
+    // Whether every slot carved from block b is marked free in freeMap.
+    bool all_free(const FreeMap& freeMap, size_t b) const
+    {
+        const uint64_t* words = &freeMap.m_words[freeMap.m_firstWord[b]];
+        const size_t size = carved_in(b);
+        for (size_t base = 0; base < size; base += 64)
+        {
+            const uint64_t expected = size - base < 64 ? (uint64_t(1) << (size - base)) - 1 : ~uint64_t(0);
+            if (words[base / 64] != expected)
+                return false;
+        }
+        return true;
+    }
+
+    // Run the destructors of the recycled objects and free their slots.
+    void destroy_recycled()
+    {
+        for (pointer p : m_recycled)
+            destroy(p);
+        m_recycled.clear();
+    }
+
+    // Calls f(item) for every live slot in block order: slots carved so far that
+    // are not marked free in freeMap.
+    template <typename F>
+    void for_each_live(const FreeMap& freeMap, F&& f) const
+    {
+        for (size_t b = 0; b <= m_carveBlock && b < m_blocks.size(); ++b)
+        {
+            Item* items = m_blocks[b].m_items.get();
+            const size_t carved = b == m_carveBlock ? m_carveNext - items : m_blocks[b].m_size;
+            const uint64_t* words = &freeMap.m_words[freeMap.m_firstWord[b]];
+            for (size_t base = 0; base < carved; base += 64)
+            {
+                uint64_t live = ~words[base / 64];
+                if (carved - base < 64)
+                    live &= (uint64_t(1) << (carved - base)) - 1;
+
+                for (; live != 0; live &= live - 1)
+                    f(&items[base + __builtin_ctzll(live)]);
+            }
+        }
+    }
+
+    // Run the destructor of every object still alive that was constructed after
+    // `checkpoint` was marked.
+    void destroy_since(Checkpoint checkpoint)
+    {
+        std::vector<const Item*> freed;
+        for_each_free_since(checkpoint, [&freed](Item* item) { freed.push_back(item); });
+        std::sort(freed.begin(), freed.end());
+
+        const Saved& saved = m_checkpoints[checkpoint];
+        for (size_t b = saved.m_carveBlock; b <= m_carveBlock && b < m_blocks.size(); ++b)
+        {
+            Item* begin = m_blocks[b].m_items.get() + (b == saved.m_carveBlock ? saved.m_carveOffset : 0);
+            Item* end = b == m_carveBlock ? m_carveNext : m_blocks[b].m_items.get() + m_blocks[b].m_size;
+            for (Item* item = begin; item != end; ++item)
+            {
+                if (freed.empty() || !std::binary_search(freed.begin(), freed.end(), item))
+                    std::launder(reinterpret_cast<pointer>(&item->m_storage))->~type();
+            }
+        }
+    }
+
+    std::vector<Block> m_blocks;
+    [[no_unique_address]] Growth m_growth;
+    size_t m_blockSize;
+    RelaxedCounter m_capacity;
+    RelaxedCounter m_live;        // For stats(); restored by rollback().
+    RelaxedCounter m_blockCount;  // For stats(), which can't read m_blocks from another thread.
+    Item* m_nextFree;
+    Item* m_freeTail;             // Last slot on the free list, while it is not empty.
+    size_t m_carveBlock;          // Block that unused slots are carved from.
+    Item* m_carveNext;            // Next never-used slot in that block.
+    Item* m_carveEnd;
+    Item* m_carvePristine;        // Slots from here to m_carveEnd are still zero.
+    RunLists m_runs;
+    uint32_t m_runMask;           // Bit n is set if m_runs[n] is not empty.
+    std::vector<Saved> m_checkpoints;
+    std::vector<pointer> m_deferred;  // Queued by destroy_deferred(), still live.
+    std::vector<pointer> m_recycled;  // Returned by recycle(), still constructed.
+    // Free slot ranges kept off the free list: pages released by decommit(), or
+    // the never-used end of a block adopted by merge().
+    std::vector<std::pair<Item*, size_t>> m_decommitted;
+    BlockCache* m_blockCache;
+    [[no_unique_address]] Observer m_observer;
+};
+
+// Combines several callables into one overload set, e.g. one lambda per type
+// for Multipool::visit_live().
+template <typename ...Fs>
+struct overloaded : Fs... { using Fs::operator()...; };
+
+template <typename ...Fs>
+overloaded(Fs...) -> overloaded<Fs...>;
+
+// Given a list of types, the Multipool stores a tuple of Pools of all given types.
+// Request objects of any type in the given type list from the pool, and the Multipool
+// will dispatch that request to the relevant pool. This is helpful if all types that
+// need pooling are known at compile time, and avoids wasted memory by sizing member
+// pools to the objects exactly.
+template <typename ...Ts>
+class Multipool
+{
+public:
+    Multipool(size_t n)
+        : pools(Pool<Ts>{n}...)
+        , groupBlockSize(n)
+        , blockCache(nullptr)
+    {}
+
+    // Create a T* from a pool. Allocates a new block from the upstream allocator if necessary.
+    template <typename T, typename ...Args>
+    auto construct(Args&& ...args)
+    {
+        return std::get<Pool<T>>(pools).construct(std::forward<Args>(args)...);
+    }
+
+    // Destroys the given T* and deallocates its memory from the relevant pool.
+    template <typename T>
+    void destroy(T* p)
+    {
+        std::get<Pool<T>>(pools).destroy(p);
+    }
+
+    // Deallocates all backing memory for the given pool type. Does not run destructors!
+    template <typename T>
+    void release()
+    {
+        std::get<Pool<T>>(pools).release();
+    }
+
+    // Discards every object of the given pool type but keeps its blocks for reuse.
+    template <typename T>
+    void reset(bool runDestructors = false)
+    {
+        std::get<Pool<T>>(pools).reset(runDestructors);
+    }
+
+    // Discards every object in all pools, including group pools, but keeps their
+    // blocks for reuse. Destructors of group members are never run.
+    void reset_all(bool runDestructors = false)
+    {
+        std::apply([runDestructors](auto&& ...pool){ (pool.reset(runDestructors), ...); }, pools);
+        for (auto& pool : groupPools)
+            if (pool)
+                pool->reset();
+    }
+
+    // Deallocates all backing memory for all pools, including group pools. Does not run destructors!
+    void release_all()
+    {
+        std::apply([](auto&& ...pool){((pool.release()), ...);}, pools);
+        for (auto& pool : groupPools)
+            if (pool)
+                pool->release();
+    }
+
+    // Share blocks given up by any pool, group pools included, with all of them
+    // through `cache`, or stop if it is null. The cache must outlive the Multipool.
+    void set_block_cache(BlockCache* cache)
+    {
+        blockCache = cache;
+        std::apply([cache](auto& ...pool){ (pool.set_block_cache(cache), ...); }, pools);
+        for (auto& pool : groupPools)
+            if (pool)
+                pool->set_block_cache(cache);
+    }
+
+    template <typename T>
+    Pool<T>& get()
+    {
+        return std::get<Pool<T>>(pools);
+    }
+
+    template <typename T>
+    const Pool<T>& get() const
+    {
+        return std::get<Pool<T>>(pools);
+    }
+
+    // Identifies one of the pooled types in visit_type().
+    template <typename T>
+    struct type_tag { using type = T; };
+
+    // Position of T in the type list, for use as a runtime type tag.
+    template <typename T>
+    static constexpr size_t index_of()
+    {
+        constexpr bool matches[] = { std::is_same_v<T, Ts>... };
+        for (size_t i = 0; i < sizeof...(Ts); ++i)
+            if (matches[i])
+                return i;
+        return sizeof...(Ts);
+    }
+
+    // Calls f(type_tag<T>{}), where T is the index-th pooled type, and returns
+    // its result. Dispatches through a jump table built at compile time, so code
+    // that handles a runtime type tag (e.g. a deserializer) can be written once
+    // as a generic lambda instead of a switch over every type.
+    template <typename F>
+    decltype(auto) visit_type(size_t index, F&& f)
+    {
+        assert(index < sizeof...(Ts)); // Index must name a pooled type.
+        using First = std::tuple_element_t<0, std::tuple<Ts...>>;
+        using R = decltype(std::forward<F>(f)(type_tag<First>{}));
+        static constexpr R (*table[])(F&&) = { &invoke_with<Ts, F, R>... };
+        return table[index](std::forward<F>(f));
+    }
+
+    // Create an object of the index-th pooled type, returned as a Base*. Every
+    // pooled type must be convertible to Base* and constructible from args.
+    template <typename Base = void, typename ...Args>
+    Base* construct_by_index(size_t index, Args&& ...args)
+    {
+        return visit_type(index, [&](auto tag) -> Base* {
+            using T = typename decltype(tag)::type;
+            return construct<T>(std::forward<Args>(args)...);
+        });
+    }
+
+    // Destroys an object of the index-th pooled type given as a Base*.
+    template <typename Base>
+    void destroy_by_index(size_t index, Base* p)
+    {
+        visit_type(index, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            destroy<T>(static_cast<T*>(p));
+        });
+    }
+
+    // Calls f(T&) for every live object of every pooled type, pool by pool and
+    // in block order within each pool. f is typically an overloaded{...} set
+    // with one lambda per type, or a generic lambda. With parallel set, each pool
+    // is visited on its own thread, so f must be safe to call concurrently.
+    template <typename F>
+    void visit_live(F&& f, bool parallel = false)
+    {
+        if (!parallel)
+        {
+            std::apply([&f](auto& ...pool){ (pool.visit_live(f), ...); }, pools);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        std::apply([&f, &threads](auto& ...pool){
+            (threads.emplace_back([&f, &pool]{ pool.visit_live(f); }), ...);
+        }, pools);
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    // Create a group of objects, one of each of Gs, laid out back to back in a
+    // single slot of a pool shared by all groups of the same size. Objects that
+    // are always used together then share cache lines instead of sitting in
+    // separate per-type pools. Pass either no arguments, to default-construct
+    // every member, or one argument per member to construct it from. The types
+    // need not be among the Multipool's own types.
+    template <typename ...Gs, typename ...Args>
+    [[nodiscard]] std::tuple<Gs*...> construct_group(Args&& ...args)
+    {
+        static_assert(sizeof...(Args) == 0 || sizeof...(Args) == sizeof...(Gs), "pass one argument per member, or none");
+        using Layout = GroupLayout<Gs...>;
+        auto& pool = group_pool<Layout::size, Layout::align>();
+        auto* slot = pool.construct();
+        try
+        {
+            return construct_members<Gs...>(reinterpret_cast<std::byte*>(slot), std::index_sequence_for<Gs...>{},
+                                            std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            pool.destroy(slot);
+            throw;
+        }
+    }
+
+    // Destroys a group created by construct_group(), member by member in order,
+    // and deallocates its slot.
+    template <typename ...Gs>
+    void destroy_group(std::tuple<Gs*...> group)
+    {
+        using Layout = GroupLayout<Gs...>;
+        auto* first = std::get<0>(group);
+        if (first == nullptr)
+            return;
+
+        std::apply([](Gs* ...member){ (member->~Gs(), ...); }, group);
+        group_pool<Layout::size, Layout::align>().destroy(reinterpret_cast<GroupSlot<Layout::size, Layout::align>*>(first));
+    }
+
+    Multipool(const Multipool&) = delete;
+    Multipool(Multipool&&) = delete;
+    Multipool& operator=(Multipool&&) = delete;
+    Multipool& operator=(const Multipool&) = delete;
+
+private:
+    template <typename T, typename F, typename R>
+    static R invoke_with(F&& f)
+    {
+        return std::forward<F>(f)(type_tag<T>{});
+    }
+
+    // Offsets of each of Gs within a group, in order, each aligned for its type.
+    template <typename ...Gs>
+    struct GroupLayout
+    {
+        static constexpr size_t align = std::max({alignof(Gs)...});
+
+        static constexpr std::array<size_t, sizeof...(Gs)> offsets = []{
+            constexpr size_t sizes[] = { sizeof(Gs)... };
+            constexpr size_t aligns[] = { alignof(Gs)... };
+            std::array<size_t, sizeof...(Gs)> result{};
+            size_t offset = 0;
+            for (size_t i = 0; i < sizeof...(Gs); ++i)
+            {
+                offset = (offset + aligns[i] - 1) / aligns[i] * aligns[i];
+                result[i] = offset;
+                offset += sizes[i];
+            }
+            return result;
+        }();
+
+        static constexpr size_t size =
+            (offsets.back() + sizeof(std::tuple_element_t<sizeof...(Gs) - 1, std::tuple<Gs...>>) + align - 1) / align * align;
+    };
+
+    template <size_t Size, size_t Align>
+    struct GroupSlot
+    {
+        GroupSlot() {} // Leaves the storage uninitialized.
+
+        std::aligned_storage_t<Size, Align> m_storage;
+    };
+
+    struct GroupPoolBase
+    {
+        virtual ~GroupPoolBase() = default;
+        virtual void release() = 0;
+        virtual void reset() = 0;
+        virtual void set_block_cache(BlockCache* cache) = 0;
+    };
+
+    template <size_t Size, size_t Align>
+    struct GroupPool : GroupPoolBase
+    {
+        GroupPool(size_t n) : pool(n) {}
+        void release() override { pool.release(); }
+        void reset() override { pool.reset(); }
+        void set_block_cache(BlockCache* cache) override { pool.set_block_cache(cache); }
+
+        Pool<GroupSlot<Size, Align>> pool;
+    };
+
+    template <typename ...Gs, typename ...Args, size_t ...I>
+    static std::tuple<Gs*...> construct_members(std::byte* base, std::index_sequence<I...>, Args&& ...args)
+    {
+        using Layout = GroupLayout<Gs...>;
+        size_t built = 0;
+        try
+        {
+            // Braced initializers run in order, so members are built first to last.
+            if constexpr (sizeof...(Args) == 0)
+                return std::tuple<Gs*...>{ construct_member<Gs>(base + Layout::offsets[I], built)... };
+            else
+                return std::tuple<Gs*...>{ construct_member<Gs>(base + Layout::offsets[I], built, std::forward<Args>(args))... };
+        }
+        catch (...)
+        {
+            // Destroy the members already built, last first.
+            (destroy_member<sizeof...(Gs) - 1 - I, Gs...>(base, built), ...);
+            throw;
+        }
+    }
+
+    template <typename G, typename ...Arg>
+    static G* construct_member(std::byte* at, size_t& built, Arg&& ...arg)
+    {
+        G* member = new (at) G(std::forward<Arg>(arg)...);
+        ++built;
+        return member;
+    }
+
+    // Destroy member J of a group if it is among the first `built`.
+    template <size_t J, typename ...Gs>
+    static void destroy_member(std::byte* base, size_t built) noexcept
+    {
+        using G = std::tuple_element_t<J, std::tuple<Gs...>>;
+        if (J < built)
+            std::launder(reinterpret_cast<G*>(base + GroupLayout<Gs...>::offsets[J]))->~G();
+    }
+
+    // Group pools are keyed by slot size and alignment, so every group type
+    // with the same footprint shares one pool.
+    static size_t next_group_id()
+    {
+        static std::atomic<size_t> nextId{0};
+        return nextId++;
+    }
+
+    template <size_t Size, size_t Align>
+    static size_t group_id()
+    {
+        static const size_t id = next_group_id();
+        return id;
+    }
+
+    template <size_t Size, size_t Align>
+    Pool<GroupSlot<Size, Align>>& group_pool()
+    {
+        const size_t id = group_id<Size, Align>();
+        if (id >= groupPools.size())
+            groupPools.resize(id + 1);
+
+        auto& pool = groupPools[id];
+        if (!pool)
+        {
+            pool = std::make_unique<GroupPool<Size, Align>>(groupBlockSize);
+            pool->set_block_cache(blockCache);
+        }
+
+        return static_cast<GroupPool<Size, Align>&>(*pool).pool;
+    }
+
+    std::tuple<Pool<Ts>...> pools;
+    std::vector<std::unique_ptr<GroupPoolBase>> groupPools;
+    size_t groupBlockSize;
+    BlockCache* blockCache;
+};
+
+// A pool for a class hierarchy. Any of the Derived types can be constructed,
+// and all of them share one free list of slots sized and aligned for the largest.
+// Objects are destroyed through a Base* via its virtual destructor, so callers
+// don't need to know the dynamic type. Compared with a Multipool of the same
+// types there is a single set of blocks and no per-type slack, at the price of
+// every object taking up the largest type's slot.
+template <typename Base, typename ...Derived>
+class PolyPool
+{
+    static_assert(std::has_virtual_destructor_v<Base>, "objects are destroyed through Base*");
+    static_assert((std::is_base_of_v<Base, Derived> && ...), "pooled types must derive from Base");
+
+public:
+    static constexpr size_t slot_size = std::max({sizeof(Derived)...});
+    static constexpr size_t slot_align = std::max({alignof(Derived)...});
+
+    PolyPool(size_t n)
+        : m_pool(n)
+    {}
+
+    // Create a T* from the shared pool. Allocates a new block from the upstream allocator if necessary.
+    template <typename T, typename ...Args>
+    [[nodiscard]] T* construct(Args&& ...args)
+    {
+        static_assert((std::is_same_v<T, Derived> || ...), "PolyPool does not pool this type");
+        Slot* slot = m_pool.construct();
+        return new (&slot->m_storage) T(std::forward<Args>(args)...);
+    }
+
+    // Destroys the given object, whatever its dynamic type, and deallocates its slot.
+    void destroy(Base* p)
+    {
+        if (p == nullptr)
+            return;
+
+        void* storage = dynamic_cast<void*>(p);
+        p->~Base();
+        m_pool.destroy(reinterpret_cast<Slot*>(storage));
+    }
+
+    // Deallocates all backing memory. Does not run destructors!
+    void release()
+    {
+        m_pool.release();
+    }
+
+    // Number of objects the pool's blocks can hold.
+    size_t capacity() const { return m_pool.capacity(); }
+
+    PolyPool(const PolyPool&) = delete;
+    PolyPool& operator=(const PolyPool&) = delete;
+
+private:
+    struct Slot
+    {
+        Slot() {} // Leaves the storage uninitialized.
+
+        std::aligned_storage_t<slot_size, slot_align> m_storage;
+    };
+
+    Pool<Slot> m_pool;
+};
+
+// How long an object is expected to live, as a hint to LifetimePool. Any class
+// below the pool's Classes may be given by number, e.g. Lifetime{2}.
+enum class Lifetime : size_t
+{
+    Long = 0,
+    Short = 1,
+};
+
+// A pool that keeps objects of different expected lifetimes in separate sets of
+// blocks, one Pool per lifetime class. Long-lived objects then never pin the
+// blocks of short-lived ones, which empty out completely once their objects die
+// and can be returned by trim() or reused wholesale by reset(). destroy() finds
+// an object's class by looking its address up among the blocks of each
+// class but the first, in time logarithmic in the number of blocks.
+template <typename T, size_t Classes = 2, size_t GrowthFactor = 2, size_t MaxBlockSize = 1024>
+class LifetimePool
+{
+    static_assert(Classes > 0, "need at least one lifetime class");
+
+public:
+    using type = T;
+    using pointer = T*;
+    using ClassPool = Pool<T, GrowthFactor, MaxBlockSize, GeometricGrowth<GrowthFactor>, BlockMapObserver>;
+
+    LifetimePool(size_t n)
+        : m_pools(make_pools(n, std::make_index_sequence<Classes>{}))
+    {}
+
+    // Create a T* among the blocks of the given lifetime class.
+    template <typename ...Args>
+    [[nodiscard]] pointer construct(Lifetime lifetime, Args&& ...args)
+    {
+        return get(lifetime).construct(std::forward<Args>(args)...);
+    }
+
+    // Destroys the given object, whatever its lifetime class.
+    void destroy(pointer p)
+    {
+        if (p == nullptr)
+            return;
+
+        for (size_t c = 1; c < Classes; ++c)
+        {
+            if (m_pools[c].observer().owns(p))
+            {
+                m_pools[c].destroy(p);
+                return;
+            }
+        }
+        m_pools[0].destroy(p);
+    }
+
+    // Return the blocks with no live objects in any class.
+    void trim()
+    {
+        for (ClassPool& pool : m_pools)
+            pool.trim();
+    }
+
+    // Discard every object of one lifetime class but keep its blocks for reuse.
+    void reset(Lifetime lifetime, bool runDestructors = false)
+    {
+        get(lifetime).reset(runDestructors);
+    }
+
+    // Deallocates all backing memory. Does not run destructors!
+    void release()
+    {
+        for (ClassPool& pool : m_pools)
+            pool.release();
+    }
+
+    ClassPool& get(Lifetime lifetime)
+    {
+        assert(static_cast<size_t>(lifetime) < Classes); // Lifetime class must exist.
+        return m_pools[static_cast<size_t>(lifetime)];
+    }
+
+    // Number of objects the blocks of every class can hold.
+    size_t capacity() const
+    {
+        size_t capacity = 0;
+        for (const ClassPool& pool : m_pools)
+            capacity += pool.capacity();
+        return capacity;
+    }
+
+    LifetimePool(const LifetimePool&) = delete;
+    LifetimePool& operator=(const LifetimePool&) = delete;
+
+private:
+    template <size_t ...C>
+    static std::array<ClassPool, Classes> make_pools(size_t n, std::index_sequence<C...>)
+    {
+        return { ((void)C, ClassPool(n))... };
+    }
+
+    std::array<ClassPool, Classes> m_pools;
+};
+
+// An opt-in, process-wide list of named pools. Registering a pool costs nothing
+// on its allocation path: the pool keeps its size counters up to date anyway,
+// and reading them is safe from any thread. A sampler thread can snapshot all
+// registered pools periodically and hand the samples to a sink, such as one
+// that writes a Prometheus text or JSON file for a dashboard to scrape.
+//
+// A registered pool must not move or be destroyed before its Registration.
+class PoolRegistry
+{
+public:
+    struct Sample
+    {
+        std::string m_name;
+        std::string m_type;   // Type of the pooled objects.
+        PoolStats m_stats;
+    };
+
+    using Sink = std::function<void(const std::vector<Sample>&)>;
+
+    // Keeps pools registered until it is destroyed.
+    class Registration
+    {
+    public:
+        Registration() = default;
+        Registration(Registration&& other) noexcept : m_ids(std::move(other.m_ids)) { other.m_ids.clear(); }
+        Registration& operator=(Registration&& other) noexcept
+        {
+            std::swap(m_ids, other.m_ids);
+            return *this;
+        }
+        ~Registration() { PoolRegistry::instance().remove(m_ids); }
+
+    private:
+        friend class PoolRegistry;
+        std::vector<size_t> m_ids;
+    };
+
+    static PoolRegistry& instance()
+    {
+        static PoolRegistry registry;
+        return registry;
+    }
+
+    ~PoolRegistry()
+    {
+        stop_sampler();
+    }
+
+    // Register a pool under the given name.
+    template <typename T, size_t GrowthFactor, size_t MaxBlockSize, typename Growth, typename Observer>
+    [[nodiscard]] Registration add(const std::string& name,
+                                   const Pool<T, GrowthFactor, MaxBlockSize, Growth, Observer>& pool)
+    {
+        Registration registration;
+        registration.m_ids.push_back(add_entry(name, type_name<T>(), [&pool] { return pool.stats(); }));
+        return registration;
+    }
+
+    // Register each of a Multipool's pools under the given name.
+    template <typename ...Ts>
+    [[nodiscard]] Registration add(const std::string& name, const Multipool<Ts...>& multipool)
+    {
+        Registration registration;
+        (registration.m_ids.push_back(add_entry(name, type_name<Ts>(), [&multipool] {
+            return multipool.template get<Ts>().stats();
+        })), ...);
+        return registration;
+    }
+
+    // Snapshot every registered pool, in registration order.
+    std::vector<Sample> sample() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<Sample> samples;
+        samples.reserve(m_entries.size());
+        for (const Entry& entry : m_entries)
+            samples.push_back({entry.m_name, entry.m_type, entry.m_read()});
+        return samples;
+    }
+
+    // Start a thread that passes a sample to `sink` every `interval` until
+    // stop_sampler() is called.
+    void start_sampler(std::chrono::milliseconds interval, Sink sink)
+    {
+        stop_sampler();
+        m_stopSampler = false;
+        m_sampler = std::thread([this, interval, sink = std::move(sink)] {
+            std::unique_lock<std::mutex> lock(m_samplerMutex);
+            while (!m_samplerStopped.wait_for(lock, interval, [this] { return m_stopSampler; }))
+            {
+                lock.unlock();
+                sink(sample());
+                lock.lock();
+            }
+        });
+    }
+
+    void stop_sampler()
+    {
+        if (!m_sampler.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_samplerMutex);
+            m_stopSampler = true;
+        }
+        m_samplerStopped.notify_one();
+        m_sampler.join();
+    }
+
+    // A sink that rewrites `path` with the samples in Prometheus text format.
+    static Sink prometheus_file(std::string path)
+    {
+        return [path = std::move(path)](const std::vector<Sample>& samples) {
+            std::ostringstream out;
+            auto metric = [&](const char* metric, const char* help, auto value) {
+                out << "# HELP " << metric << " " << help << "\n# TYPE " << metric << " gauge\n";
+                for (const Sample& sample : samples)
+                {
+                    out << metric << "{pool=\"" << escape(sample.m_name) << "\",type=\"" << escape(sample.m_type)
+                        << "\"} " << value(sample.m_stats) << "\n";
+                }
+            };
+            metric("pool_capacity_slots", "Slots in all blocks.", [](const PoolStats& s) { return s.m_capacity; });
+            metric("pool_live_slots", "Slots in use.", [](const PoolStats& s) { return s.m_live; });
+            metric("pool_blocks", "Blocks allocated.", [](const PoolStats& s) { return s.m_blocks; });
+            metric("pool_reserved_bytes", "Bytes in all blocks.",
+                   [](const PoolStats& s) { return s.m_capacity * s.m_slotSize; });
+            write_file(path, out.str());
+        };
+    }
+
+    // A sink that rewrites `path` with the samples as a JSON array.
+    static Sink json_file(std::string path)
+    {
+        return [path = std::move(path)](const std::vector<Sample>& samples) {
+            std::ostringstream out;
+            out << "[";
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                const Sample& sample = samples[i];
+                out << (i == 0 ? "\n" : ",\n") << "  {\"pool\": \"" << escape(sample.m_name, true)
+                    << "\", \"type\": \"" << escape(sample.m_type, true)
+                    << "\", \"capacity_slots\": " << sample.m_stats.m_capacity
+                    << ", \"live_slots\": " << sample.m_stats.m_live
+                    << ", \"blocks\": " << sample.m_stats.m_blocks
+                    << ", \"reserved_bytes\": " << sample.m_stats.m_capacity * sample.m_stats.m_slotSize << "}";
+            }
+            out << "\n]\n";
+            write_file(path, out.str());
+        };
+    }
+
+    PoolRegistry(const PoolRegistry&) = delete;
+    PoolRegistry& operator=(const PoolRegistry&) = delete;
+
+private:
+    PoolRegistry() = default;
+
+    struct Entry
+    {
+        size_t m_id;
+        std::string m_name;
+        std::string m_type;
+        std::function<PoolStats()> m_read;
+    };
+
+    size_t add_entry(const std::string& name, std::string type, std::function<PoolStats()> read)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.push_back({m_nextId, name, std::move(type), std::move(read)});
+        return m_nextId++;
+    }
+
+    void remove(const std::vector<size_t>& ids)
+    {
+        if (ids.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), [&ids](const Entry& entry) {
+            return std::find(ids.begin(), ids.end(), entry.m_id) != ids.end();
+        }), m_entries.end());
+    }
+
+    template <typename T>
+    static std::string type_name()
+    {
+        const char* mangled = typeid(T).name();
+#if POOL_HAVE_CXXABI
+        int status = 0;
+        std::unique_ptr<char, void (*)(void*)> demangled(abi::__cxa_demangle(mangled, nullptr, nullptr, &status),
+                                                         std::free);
+        if (status == 0 && demangled)
+            return demangled.get();
+#endif
+        return mangled;
+    }
+
+    // Escape backslashes, quotes and newlines, as both Prometheus label values and JSON strings require.
+    // JSON strings also need the other control characters escaped.
+    static std::string escape(const std::string& text, bool json = false)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '\\' || c == '"')
+                escaped += '\\';
+            if (c == '\n')
+            {
+                escaped += "\\n";
+            }
+            else if (json && static_cast<unsigned char>(c) < 0x20)
+            {
+                char code[7];
+                std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+                escaped += code;
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    // Write to a temporary file and rename it over `path`, so a scraper never
+    // sees a partly written file.
+    static void write_file(const std::string& path, const std::string& contents)
+    {
+        const std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::trunc);
+            file << contents;
+            if (!file)
+                return;
+        }
+        std::rename(temporary.c_str(), path.c_str());
+    }
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    size_t m_nextId = 0;
+
+    std::mutex m_samplerMutex;
+    std::condition_variable m_samplerStopped;
+    bool m_stopSampler = false;
+    std::thread m_sampler;
+};
+
+// A pool of T-sized slots shared by every thread in the process. Each thread
+// allocates from its own cache (a Pool of slots), so the fast path takes no
+// locks. Every slot records the cache that handed it out: freeing a slot on the
+// owning thread returns it straight to that cache, while freeing it on any other
+// thread pushes it onto the owner's lock-free remote list. When a thread exits its
+// cache is parked and adopted by the next thread that needs one, so slots that
+// outlive their allocating thread stay valid and the number of caches is bounded
+// by the peak number of concurrent threads.
+//
+// Free slots are rebalanced between caches so no thread hoards them while
+// another grows. A cache holding more than HighWatermark free slots, after a
+// local free or after reclaiming remote frees, moves batches of BatchSize slots
+// to a global depot. A cache that runs dry first reclaims its
+// own remote frees, then takes batches from the depot, then steals the remote
+// frees waiting for other caches, and only grows if all of those are empty.
+// Remote lists are lock-free stacks that are only ever pushed to or emptied as a
+// whole, so they are immune to ABA. The depot is a lock-free stack whose head
+// pairs the top pointer with a version counter, swapped together by a
+// double-width compare-and-swap (link with -latomic). Each cache's pool counts
+// only the slots it handed out: slots moved through the depot or stolen from
+// another cache's remote list are passed on uncounted. With Rebalance false,
+// caches only ever reuse their own slots, for comparison.
+template <typename T, bool Rebalance = true>
+class ThreadLocalPool
+{
+public:
+    static constexpr size_t BatchSize = 256;
+    static constexpr size_t HighWatermark = 4 * BatchSize;
+
+    // Returns uninitialized storage suitable for a T.
+    [[nodiscard]] static void* allocate()
+    {
+        Cache& cache = local();
+        if (cache.m_pool.full())
+            cache.refill();
+
+        const size_t capacity = cache.m_pool.capacity();
+        Slot* slot = cache.m_pool.construct(&cache);
+        cache.m_free += cache.m_pool.capacity() - capacity; // Grown by a block.
+        cache.m_free--;
+        return &slot->m_storage;
+    }
+
+    // Returns storage obtained from allocate(). May be called from any thread.
+    static void deallocate(void* p) noexcept
+    {
+        Slot* slot = reinterpret_cast<Slot*>(static_cast<std::byte*>(p) - offsetof(Slot, m_storage));
+        Cache* owner = slot->m_owner;
+        if (owner != t_cache)
+        {
+            owner->push_remote(slot);
+            return;
+        }
+
+        owner->m_pool.destroy(slot);
+        if (++owner->m_free > HighWatermark && Rebalance)
+            owner->spill(BatchSize);
+    }
+
+    // Number of objects all threads' caches can hold. Reads every cache without
+    // synchronization, so only call it while no other thread is allocating.
+    static size_t capacity()
+    {
+        size_t total = 0;
+        for (Cache* cache = s_caches.load(std::memory_order_acquire); cache != nullptr; cache = cache->m_nextCache)
+            total += cache->m_pool.capacity();
+
+        return total;
+    }
+
+    // Size counters summed over all threads' caches. May be called while other
+    // threads allocate, in which case the caches are read at slightly different
+    // times. Slots freed on another thread count as live until a cache takes
+    // them back.
+    static PoolStats stats()
+    {
+        PoolStats total{0, 0, 0, 0};
+        for (Cache* cache = s_caches.load(std::memory_order_acquire); cache != nullptr; cache = cache->m_nextCache)
+        {
+            const PoolStats stats = cache->m_pool.stats();
+            total.m_capacity += stats.m_capacity;
+            total.m_live += stats.m_live - cache->m_stolen.load(std::memory_order_relaxed);
+            total.m_blocks += stats.m_blocks;
+            total.m_slotSize = stats.m_slotSize;
+        }
+        return total;
+    }
+
+private:
+    struct Cache;
+
+    struct Slot
+    {
+        explicit Slot(Cache* owner) : m_owner(owner) {}
+
+        union
+        {
+            Cache* m_owner;
+            Slot* m_nextBatch; // While the first slot of a batch in the depot.
+        };
+        union
+        {
+            std::aligned_storage_t<sizeof(T), alignof(T)> m_storage;
+            Slot* m_nextRemote; // While on a remote list or in a depot batch.
+        };
+    };
+
+    // The depot's top batch, and a version bumped by every push and pop.
+    struct alignas(2 * sizeof(void*)) DepotHead
+    {
+        Slot* m_top;
+        uintptr_t m_version;
+    };
+
+    static void depot_push(Slot* batch) noexcept
+    {
+        DepotHead head = s_depot.load(std::memory_order_relaxed);
+        do
+        {
+            batch->m_nextBatch = head.m_top;
+        } while (!s_depot.compare_exchange_weak(head, DepotHead{batch, head.m_version + 1}, std::memory_order_release,
+                                                std::memory_order_relaxed));
+    }
+
+    static Slot* depot_pop() noexcept
+    {
+        DepotHead head = s_depot.load(std::memory_order_acquire);
+        for (;;)
+        {
+            if (head.m_top == nullptr)
+                return nullptr;
+
+            // If another thread pops `top` first this may read a slot in use, but
+            // the version will have changed and the exchange will fail.
+            Slot* next = __atomic_load_n(&head.m_top->m_nextBatch, __ATOMIC_RELAXED);
+            if (s_depot.compare_exchange_weak(head, DepotHead{next, head.m_version + 1}, std::memory_order_acquire,
+                                              std::memory_order_acquire))
+                return head.m_top;
+        }
+    }
+
+    struct Cache
+    {
+        void push_remote(Slot* slot) noexcept
+        {
+            Slot* head = m_remoteFree.load(std::memory_order_relaxed);
+            do
+            {
+                slot->m_nextRemote = head;
+            } while (!m_remoteFree.compare_exchange_weak(head, slot, std::memory_order_release,
+                                                         std::memory_order_relaxed));
+        }
+
+        // Return a chain of slots linked through m_nextRemote to the local free
+        // list. Slots this cache handed out stop counting as live; others were
+        // never counted here. Returns the number of slots.
+        size_t take(Slot* slot, bool own) noexcept
+        {
+            size_t n = 0;
+            for (; slot != nullptr; ++n)
+            {
+                Slot* next = slot->m_nextRemote;
+                if (own)
+                    m_pool.destroy(slot);
+                else
+                    m_pool.attach_free(slot);
+                slot = next;
+            }
+            m_free += n;
+            return n;
+        }
+
+        // Stop counting the slots other caches stole from our remote list.
+        void settle() noexcept
+        {
+            if (m_stolen.load(std::memory_order_relaxed) != 0)
+                m_pool.disown(m_stolen.exchange(0, std::memory_order_relaxed));
+        }
+
+        // Move up to n free slots to the depot as one batch.
+        void spill(size_t n) noexcept
+        {
+            settle();
+            if (n == 0 || m_pool.full())
+                return;
+
+            Slot* first = new (m_pool.detach_free()) Slot(nullptr);
+            Slot* last = first;
+            for (size_t i = 1; i < n && !m_pool.full(); ++i)
+            {
+                Slot* slot = new (m_pool.detach_free()) Slot(nullptr);
+                last->m_nextRemote = slot;
+                last = slot;
+                m_free--;
+            }
+            m_free--;
+            last->m_nextRemote = nullptr;
+            depot_push(first);
+        }
+
+        // Find free slots before the pool grows: our own remote frees, then a
+        // batch from the depot, then remote frees waiting for other caches.
+        void refill() noexcept
+        {
+            settle();
+            take(m_remoteFree.exchange(nullptr, std::memory_order_acquire), true);
+            if (!Rebalance)
+                return;
+
+            if (!m_pool.full())
+            {
+                spill_excess();
+                return;
+            }
+
+            if (Slot* batch = depot_pop())
+            {
+                take(batch, false);
+                return;
+            }
+
+            for (Cache* victim = s_caches.load(std::memory_order_acquire); victim != nullptr; victim = victim->m_nextCache)
+            {
+                if (victim == this || victim->m_remoteFree.load(std::memory_order_relaxed) == nullptr)
+                    continue;
+
+                const size_t stolen = take(victim->m_remoteFree.exchange(nullptr, std::memory_order_acquire), false);
+                victim->m_stolen.fetch_add(stolen, std::memory_order_relaxed);
+                if (!m_pool.full())
+                {
+                    spill_excess();
+                    return;
+                }
+            }
+        }
+
+        // A whole remote list can hold far more slots than the thread needs, and
+        // a thread that only frees remotely never spills them. Keep no more
+        // than one that frees locally would.
+        void spill_excess() noexcept
+        {
+            while (m_free > HighWatermark)
+                spill(BatchSize);
+        }
+
+        Pool<Slot> m_pool{64};
+        size_t m_free = 64; // Slots on m_pool's free list.
+        std::atomic<Slot*> m_remoteFree{nullptr};
+        std::atomic<size_t> m_stolen{0}; // Slots taken from m_remoteFree by other caches.
+        Cache* m_nextOrphan = nullptr;
+        Cache* m_nextCache = nullptr;
+    };
+
+    // Parks the calling thread's cache when the thread exits, first handing its
+    // free slots to the depot so other threads can use them.
+    struct CacheHolder
+    {
+        ~CacheHolder()
+        {
+            if (t_cache == nullptr)
+                return;
+
+            t_cache->take(t_cache->m_remoteFree.exchange(nullptr, std::memory_order_acquire), true);
+            while (!t_cache->m_pool.full() && Rebalance)
+                t_cache->spill(BatchSize);
+
+            std::lock_guard<std::mutex> lock(s_orphanMutex);
+            t_cache->m_nextOrphan = s_orphans;
+            s_orphans = t_cache;
+            t_cache = nullptr;
+        }
+    };
+
+    static Cache& local()
+    {
+        if (t_cache != nullptr)
+            return *t_cache;
+
+        return adopt();
+    }
+
+    // Slow path: take over a parked cache, or create a new one. Caches are never
+    // destroyed, since slots they handed out may be freed at any later point.
+    static Cache& adopt()
+    {
+        static thread_local CacheHolder holder;
+        (void)holder;
+#if POOL_HAVE_ATFORK
+        // Hold the orphan lock across fork(), so the child never inherits it
+        // locked by a thread that doesn't exist there.
+        static const int forkHandlers = pthread_atfork([] { s_orphanMutex.lock(); },
+                                                       [] { s_orphanMutex.unlock(); },
+                                                       [] { s_orphanMutex.unlock(); });
+        (void)forkHandlers;
+#endif
+
+        {
+            std::lock_guard<std::mutex> lock(s_orphanMutex);
+            if (s_orphans != nullptr)
+            {
+                t_cache = s_orphans;
+                s_orphans = s_orphans->m_nextOrphan;
+                t_cache->m_nextOrphan = nullptr;
+                return *t_cache;
+            }
+        }
+
+        Cache* cache = new Cache();
+        cache->m_nextCache = s_caches.load(std::memory_order_relaxed);
+        while (!s_caches.compare_exchange_weak(cache->m_nextCache, cache, std::memory_order_release,
+                                               std::memory_order_relaxed))
+        {}
+
+        t_cache = cache;
+        return *t_cache;
+    }
+
+    static inline thread_local Cache* t_cache = nullptr;
+    static inline std::mutex s_orphanMutex;
+    static inline Cache* s_orphans = nullptr;
+    static inline std::atomic<Cache*> s_caches{nullptr}; // Every cache ever created.
+    static inline std::atomic<DepotHead> s_depot{DepotHead{nullptr, 0}}; // Batches of free slots.
+};
+
+// Storage for one object allocated through PoolAllocated<T>. Plain operator
+// new(size) doesn't know the type it allocates for, so a class derived from T
+// with T's size but a stricter alignment lands in the same slots. The slots are
+// therefore aligned as the global operator new would align any object of that
+// size: to the largest power of two dividing it, up to the default new
+// alignment, and never less than T's.
+template <typename T>
+struct PoolAllocatedSlot
+{
+    static constexpr std::size_t Align =
+        std::max(alignof(T), std::min(sizeof(T) & (~sizeof(T) + 1), std::size_t(__STDCPP_DEFAULT_NEW_ALIGNMENT__)));
+
+    alignas(Align) std::byte m_bytes[sizeof(T)];
+};
+
+// CRTP base that routes class-level new and delete for T through a
+// ThreadLocalPool, so existing `new T(...)`/`delete p` code is pooled without
+// changes. Allocations whose size differs from T's, or whose alignment exceeds
+// the slots' (for instance a class derived from T that adds members), fall back
+// to the global heap; this is decided from the size the compiler passes to
+// operator delete, so T must have a virtual destructor if it is deleted through
+// a base pointer. Objects may be deleted on any thread.
+template <typename T>
+struct PoolAllocated
+{
+    using Slots = ThreadLocalPool<PoolAllocatedSlot<T>>;
+
+    static void* operator new(std::size_t size)
+    {
+        if (size != sizeof(T))
+            return ::operator new(size);
+
+        return Slots::allocate();
+    }
+
+    static void* operator new(std::size_t size, std::align_val_t align)
+    {
+        if (size != sizeof(T) || static_cast<std::size_t>(align) > PoolAllocatedSlot<T>::Align)
+            return ::operator new(size, align);
+
+        return Slots::allocate();
+    }
+
+    static void operator delete(void* p, std::size_t size) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        if (size != sizeof(T))
+            ::operator delete(p, size);
+        else
+            Slots::deallocate(p);
+    }
+
+    static void operator delete(void* p, std::size_t size, std::align_val_t align) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        if (size != sizeof(T) || static_cast<std::size_t>(align) > PoolAllocatedSlot<T>::Align)
+            ::operator delete(p, size, align);
+        else
+            Slots::deallocate(p);
+    }
+};
@@ -0,0 +1,415 @@
+// A malloc replacement built on size-classed pools, meant to be injected into an
+// unmodified binary with LD_PRELOAD to evaluate the pool design on whole programs:
+//
+//     make malloc
+//     LD_PRELOAD=./libpoolmalloc.so ./some_program
+//
+// Requests up to the largest size class are served from a ThreadLocalPool per
+// class, so each thread allocates from its own free lists and frees from other
+// threads are handed back to the allocating thread. Requests aligned to more
+// than 16 bytes, up to kMaxSmallAlign, get size classes of their own whose slots
+// are aligned. Larger requests are mapped directly with mmap and unmapped on free.
+//
+// Every allocation is preceded by a small header. The 32-bit word right before
+// the returned pointer holds the size class, kArenaClass for arena blocks, or
+// kLargeClass for mapped blocks:
+//
+//     small:   [slot owner (8)][unused (4)][class (4)] user data
+//     aligned: [slot owner (8)][padding   ][class (4)] user data
+//     arena:   [bin (8)       ][offset (4)][class (4)] user data
+//     large:   [length (8)    ][offset (4)][class (4)] user data
+//
+// ThreadLocalPool aligns a slot's storage to the storage type's alignment, so an
+// aligned class's slot has padding between the owner pointer and the user data,
+// and its class is kept there.
+//
+// The pools themselves allocate their blocks and bookkeeping through operator
+// new, which lands back in this malloc. While a thread is inside the allocator
+// such nested requests are served from a small arena with power-of-two bins
+// under a lock, or mapped directly if they are too large for it, so a pool is
+// never re-entered while it is growing.
+
+#include "pool.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr size_t kClassSizes[] = {
+        16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+        320, 384, 448, 512, 640, 768, 896, 1024
+    };
+    constexpr size_t kClassCount = std::size(kClassSizes);
+    constexpr size_t kMaxSmallSize = kClassSizes[kClassCount - 1];
+    constexpr uint32_t kLargeClass = UINT32_MAX;
+    constexpr uint32_t kArenaClass = UINT32_MAX - 1;
+    constexpr size_t kHeaderSize = 16;
+    constexpr size_t kMinAlign = 16;
+
+    // Alignments served from size classes: kMinAlign << level for each level, with
+    // kClassCount classes per level.
+    constexpr size_t kAlignLevels = 4;
+    constexpr size_t kMaxSmallAlign = kMinAlign << (kAlignLevels - 1);
+
+    // Nested requests up to kArenaMaxBin bytes, header included, come from
+    // kArenaChunk-sized mappings, in bins of 32 bytes and up by powers of two.
+    constexpr size_t kArenaMinBin = 32;
+    constexpr size_t kArenaMaxBin = size_t(64) << 10;
+    constexpr size_t kArenaBins = 12;
+    constexpr size_t kArenaChunk = size_t(1) << 20;
+    static_assert(kArenaMinBin << (kArenaBins - 1) == kArenaMaxBin);
+
+    // Maps (size + 15) / 16 to the smallest class that fits.
+    constexpr auto kClassLookup = []{
+        std::array<uint8_t, kMaxSmallSize / 16 + 1> lookup{};
+        size_t cls = 0;
+        for (size_t i = 0; i < lookup.size(); ++i)
+        {
+            while (kClassSizes[cls] < i * 16)
+                ++cls;
+            lookup[i] = static_cast<uint8_t>(cls);
+        }
+        return lookup;
+    }();
+
+    // Storage for one small allocation: the 8-byte header followed by the user
+    // data. ThreadLocalPool prefixes each slot with an 8-byte owner pointer, so
+    // the user data of every slot is 16-byte aligned.
+    template <size_t N>
+    struct Chunk
+    {
+        uint32_t m_reserved;
+        uint32_t m_class;
+        std::byte m_data[N];
+    };
+
+    // Storage for one over-aligned allocation. Its header sits in the slot's
+    // padding, just before it.
+    template <size_t N, size_t Align>
+    struct AlignedChunk
+    {
+        alignas(Align) std::byte m_data[N];
+    };
+
+    template <size_t Class>
+    using Storage = std::conditional_t<Class < kClassCount, Chunk<kClassSizes[Class % kClassCount]>,
+                                       AlignedChunk<kClassSizes[Class % kClassCount], (kMinAlign << (Class / kClassCount))>>;
+
+    struct LargeHeader
+    {
+        size_t m_length;   // Bin index for arena blocks.
+        uint32_t m_offset;
+        uint32_t m_class;
+    };
+    static_assert(sizeof(LargeHeader) == kHeaderSize);
+
+    __attribute__((tls_model("initial-exec"))) thread_local bool t_inAllocator = false;
+
+    template <size_t Class>
+    void* allocate_small()
+    {
+        auto* chunk = static_cast<Storage<Class>*>(ThreadLocalPool<Storage<Class>>::allocate());
+        reinterpret_cast<uint32_t*>(chunk->m_data)[-1] = Class;
+        return chunk->m_data;
+    }
+
+    template <size_t Class>
+    void deallocate_small(void* p) noexcept
+    {
+        ThreadLocalPool<Storage<Class>>::deallocate(static_cast<std::byte*>(p) - offsetof(Storage<Class>, m_data));
+    }
+
+    template <size_t ...Classes>
+    constexpr auto make_allocate_table(std::index_sequence<Classes...>)
+    {
+        return std::array<void* (*)(), sizeof...(Classes)>{ &allocate_small<Classes>... };
+    }
+
+    template <size_t ...Classes>
+    constexpr auto make_deallocate_table(std::index_sequence<Classes...>)
+    {
+        return std::array<void (*)(void*) noexcept, sizeof...(Classes)>{ &deallocate_small<Classes>... };
+    }
+
+    constexpr auto kAllocate = make_allocate_table(std::make_index_sequence<kClassCount * kAlignLevels>{});
+    constexpr auto kDeallocate = make_deallocate_table(std::make_index_sequence<kClassCount * kAlignLevels>{});
+
+    uint32_t class_of(const void* p)
+    {
+        return static_cast<const uint32_t*>(p)[-1];
+    }
+
+    const LargeHeader* large_header(const void* p)
+    {
+        return reinterpret_cast<const LargeHeader*>(static_cast<const std::byte*>(p) - kHeaderSize);
+    }
+
+    // Point the header before the first `align`-aligned address past base's
+    // header space at the block, and return that address.
+    void* place(void* base, size_t length, size_t align, uint32_t cls)
+    {
+        auto start = reinterpret_cast<uintptr_t>(base);
+        uintptr_t user = (start + kHeaderSize + align - 1) & ~(uintptr_t(align) - 1);
+        auto* header = reinterpret_cast<LargeHeader*>(user - kHeaderSize);
+        header->m_length = length;
+        header->m_offset = static_cast<uint32_t>(user - start);
+        header->m_class = cls;
+        return reinterpret_cast<void*>(user);
+    }
+
+    void* map_large(size_t size, size_t align)
+    {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        if (size > SIZE_MAX - kHeaderSize - align - page)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        const size_t length = (size + kHeaderSize + align - 1 + page - 1) & ~(page - 1);
+        void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        return place(mapping, length, align, kLargeClass);
+    }
+
+    // The arena serving nested requests. Freed blocks go on a free list per bin
+    // and are never unmapped.
+    std::mutex s_arenaMutex;
+    std::array<void*, kArenaBins> s_arenaFree{};
+    std::byte* s_arenaNext = nullptr;
+    std::byte* s_arenaEnd = nullptr;
+
+    void* arena_allocate(size_t size, size_t align)
+    {
+        if (size > kArenaMaxBin || align > kArenaMaxBin || size + kHeaderSize + align - kMinAlign > kArenaMaxBin)
+            return map_large(size, align);
+
+        const size_t needed = size + kHeaderSize + align - kMinAlign;
+        size_t bin = 0;
+        while ((kArenaMinBin << bin) < needed)
+            ++bin;
+
+        void* block = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(s_arenaMutex);
+            block = s_arenaFree[bin];
+            if (block != nullptr)
+            {
+                s_arenaFree[bin] = *static_cast<void**>(block);
+            }
+            else
+            {
+                const size_t length = kArenaMinBin << bin;
+                if (static_cast<size_t>(s_arenaEnd - s_arenaNext) < length)
+                {
+                    void* chunk = mmap(nullptr, kArenaChunk, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    if (chunk == MAP_FAILED)
+                    {
+                        errno = ENOMEM;
+                        return nullptr;
+                    }
+                    s_arenaNext = static_cast<std::byte*>(chunk);
+                    s_arenaEnd = s_arenaNext + kArenaChunk;
+                }
+                block = s_arenaNext;
+                s_arenaNext += length;
+            }
+        }
+
+        return place(block, bin, align, kArenaClass);
+    }
+
+    void arena_free(void* p) noexcept
+    {
+        const LargeHeader* header = large_header(p);
+        const size_t bin = header->m_length;
+        void* block = static_cast<std::byte*>(p) - header->m_offset;
+
+        std::lock_guard<std::mutex> lock(s_arenaMutex);
+        *static_cast<void**>(block) = s_arenaFree[bin];
+        s_arenaFree[bin] = block;
+    }
+
+    // Hold the arena lock across fork(), so the child never inherits it locked
+    // by a thread that doesn't exist there.
+    __attribute__((constructor)) void register_fork_handlers()
+    {
+        pthread_atfork([] { s_arenaMutex.lock(); }, [] { s_arenaMutex.unlock(); }, [] { s_arenaMutex.unlock(); });
+    }
+
+    void* allocate(size_t size, size_t align = kMinAlign)
+    {
+        if (size == 0)
+            size = 1;
+        align = std::max(align, kMinAlign);
+
+        if (t_inAllocator)
+            return arena_allocate(size, align);
+
+        if (size > kMaxSmallSize || align > kMaxSmallAlign)
+            return map_large(size, align);
+
+        size_t level = 0;
+        while ((kMinAlign << level) < align)
+            ++level;
+
+        t_inAllocator = true;
+        void* p = nullptr;
+        try
+        {
+            p = kAllocate[level * kClassCount + kClassLookup[(size + 15) / 16]]();
+        }
+        catch (const std::bad_alloc&)
+        {
+            errno = ENOMEM;
+        }
+        t_inAllocator = false;
+        return p;
+    }
+
+    size_t usable_size(const void* p)
+    {
+        const uint32_t cls = class_of(p);
+        if (cls != kLargeClass && cls != kArenaClass)
+            return kClassSizes[cls % kClassCount];
+
+        const LargeHeader* header = large_header(p);
+        if (cls == kArenaClass)
+            return (kArenaMinBin << header->m_length) - header->m_offset;
+        return header->m_length - header->m_offset;
+    }
+
+    bool is_power_of_two(size_t n)
+    {
+        return n != 0 && (n & (n - 1)) == 0;
+    }
+}
+
+extern "C"
+{
+    void* malloc(size_t size)
+    {
+        return allocate(size);
+    }
+
+    void free(void* p)
+    {
+        if (p == nullptr)
+            return;
+
+        const uint32_t cls = class_of(p);
+        if (cls == kLargeClass)
+        {
+            const LargeHeader* header = large_header(p);
+            munmap(static_cast<std::byte*>(p) - header->m_offset, header->m_length);
+            return;
+        }
+        if (cls == kArenaClass)
+        {
+            arena_free(p);
+            return;
+        }
+
+        kDeallocate[cls](p);
+    }
+
+    void* calloc(size_t n, size_t size)
+    {
+        if (size != 0 && n > SIZE_MAX / size)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        void* p = allocate(n * size);
+        // Fresh mappings are already zero.
+        if (p != nullptr && class_of(p) != kLargeClass)
+            std::memset(p, 0, n * size);
+
+        return p;
+    }
+
+    void* realloc(void* p, size_t size)
+    {
+        if (p == nullptr)
+            return allocate(size);
+
+        if (size == 0)
+        {
+            free(p);
+            return nullptr;
+        }
+
+        const size_t oldSize = usable_size(p);
+        if (size <= oldSize)
+            return p;
+
+        void* q = allocate(size);
+        if (q == nullptr)
+            return nullptr;
+
+        std::memcpy(q, p, oldSize);
+        free(p);
+        return q;
+    }
+
+    void* aligned_alloc(size_t align, size_t size)
+    {
+        if (!is_power_of_two(align))
+        {
+            errno = EINVAL;
+            return nullptr;
+        }
+
+        return allocate(size, align);
+    }
+
+    void* memalign(size_t align, size_t size)
+    {
+        return aligned_alloc(align, size);
+    }
+
+    int posix_memalign(void** out, size_t align, size_t size)
+    {
+        if (!is_power_of_two(align) || align % sizeof(void*) != 0)
+            return EINVAL;
+
+        void* p = allocate(size, align);
+        if (p == nullptr)
+            return ENOMEM;
+
+        *out = p;
+        return 0;
+    }
+
+    void* valloc(size_t size)
+    {
+        return allocate(size, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+    }
+
+    void* pvalloc(size_t size)
+    {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return allocate((size + page - 1) & ~(page - 1), page);
+    }
+
+    size_t malloc_usable_size(void* p)
+    {
+        return p == nullptr ? 0 : usable_size(p);
+    }
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __has_include(<poll.h>) && __has_include(<fcntl.h>) && __has_include(<unistd.h>)
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#define POOL_HAVE_POLL 1
+#else
+#define POOL_HAVE_POLL 0
+#endif
+
+// Trims pools when the system runs short of memory. A Source blocks until
+// memory pressure rises or a timeout passes; the monitor's thread waits on it,
+// and on every rise relieves each watched pool whose share of free slots is
+// above its target: first with trim(), then with decommit() if trimming left
+// too much free. Nothing is added to the pools' allocation paths.
+//
+// Pools are not thread-safe, so a pool is watched together with the mutex its
+// owner holds while using it, and no scope may be left open when the mutex is
+// released. To relieve a pool on its owner's thread instead, watch a callback
+// that schedules the work there. Watched pools must be unwatched before they
+// are destroyed.
+class PressureMonitor
+{
+public:
+    // Waits up to `timeout` for memory pressure to rise, and returns whether it did.
+    using Source = std::function<bool(std::chrono::milliseconds timeout)>;
+
+    // Starts the monitor's thread. The source is given `interval` at a time, so
+    // that destroying the monitor takes at most that long.
+    explicit PressureMonitor(Source source, std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+        : m_source(std::move(source))
+        , m_interval(interval)
+    {
+        m_thread = std::thread([this] { run(); });
+    }
+
+    ~PressureMonitor()
+    {
+        m_stop = true;
+        m_thread.join();
+    }
+
+    PressureMonitor(const PressureMonitor&) = delete;
+    PressureMonitor& operator=(const PressureMonitor&) = delete;
+
+    // Watch a pool used under `mutex`, trimming it on pressure while more than
+    // targetFreeRatio of its slots are free. Returns an id for unwatch().
+    template <typename T, size_t GrowthFactor, size_t MaxBlockSize, typename Growth, typename Observer>
+    size_t watch(Pool<T, GrowthFactor, MaxBlockSize, Growth, Observer>& pool, std::mutex& mutex,
+                 double targetFreeRatio = 0.25)
+    {
+        return watch([&pool, &mutex, targetFreeRatio] {
+            auto overTarget = [&pool, targetFreeRatio] {
+                const PoolStats stats = pool.stats();
+                return stats.m_capacity - stats.m_live > targetFreeRatio * static_cast<double>(stats.m_capacity);
+            };
+
+            // The counters can be read without the lock.
+            if (!overTarget())
+                return;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            pool.trim();
+            if (overTarget())
+                pool.decommit();
+        });
+    }
+
+    // Call relieve() on every pressure rise.
+    size_t watch(std::function<void()> relieve)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watches.push_back({m_nextId, std::move(relieve)});
+        return m_nextId++;
+    }
+
+    // Stop watching. Once this returns, the watch's callback is not running and
+    // will not be called again.
+    void unwatch(size_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watches.erase(std::remove_if(m_watches.begin(), m_watches.end(), [id](const Watch& watch) {
+            return watch.m_id == id;
+        }), m_watches.end());
+    }
+
+    // Number of pressure rises the watched pools have been relieved for.
+    size_t rises() const { return m_rises; }
+
+    // A Linux PSI trigger on `path`: pressure rises when tasks were stalled on
+    // memory for `stall` in total within a `window`. Unprivileged processes
+    // need a window of at least two seconds. If the trigger can't be set up, the
+    // source never fires.
+    static Source psi(std::chrono::microseconds stall = std::chrono::milliseconds(150),
+                      std::chrono::microseconds window = std::chrono::seconds(2),
+                      const std::string& path = "/proc/pressure/memory")
+    {
+        std::shared_ptr<int> fd = open_shared(path, true);
+#if POOL_HAVE_POLL
+        if (fd != nullptr)
+        {
+            const std::string trigger = "some " + std::to_string(stall.count()) + " " + std::to_string(window.count());
+            if (write(*fd, trigger.c_str(), trigger.size() + 1) < 0)
+                fd = nullptr;
+        }
+#endif
+
+        return [fd](std::chrono::milliseconds timeout) {
+            return wait_for_event(fd.get(), timeout);
+        };
+    }
+
+    // A cgroup v2 memory.events file: pressure rises when its "high" or "max"
+    // count goes up, meaning the group was throttled at memory.high or hit
+    // memory.max. If the file can't be opened, the source never fires.
+    static Source cgroup_events(const std::string& path = "/sys/fs/cgroup/memory.events")
+    {
+        std::shared_ptr<int> fd = open_shared(path, false);
+        auto last = std::make_shared<size_t>(fd != nullptr ? read_events(*fd) : 0);
+
+        return [fd, last](std::chrono::milliseconds timeout) {
+            // The file signals every change, not just the ones counted here.
+            wait_for_event(fd.get(), timeout);
+            if (fd == nullptr)
+                return false;
+
+            const size_t events = read_events(*fd);
+            const bool rose = events > *last;
+            *last = events;
+            return rose;
+        };
+    }
+
+private:
+    struct Watch
+    {
+        size_t m_id;
+        std::function<void()> m_relieve;
+    };
+
+    void run()
+    {
+        while (!m_stop)
+        {
+            if (!m_source(m_interval))
+                continue;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (const Watch& watch : m_watches)
+                    watch.m_relieve();
+            }
+            ++m_rises;
+        }
+    }
+
+    // Opens path, returning a descriptor closed with the last copy, or nullptr.
+    static std::shared_ptr<int> open_shared(const std::string& path, bool writable)
+    {
+#if POOL_HAVE_POLL
+        const int fd = open(path.c_str(), (writable ? O_RDWR | O_NONBLOCK : O_RDONLY) | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            return std::shared_ptr<int>(new int(fd), [](int* fd) {
+                close(*fd);
+                delete fd;
+            });
+        }
+#else
+        (void)path;
+        (void)writable;
+#endif
+        return nullptr;
+    }
+
+    // Wait up to timeout for fd to signal an event with POLLPRI. Without a
+    // descriptor, just sleeps.
+    static bool wait_for_event(const int* fd, std::chrono::milliseconds timeout)
+    {
+#if POOL_HAVE_POLL
+        if (fd != nullptr)
+        {
+            pollfd request{*fd, POLLPRI, 0};
+            const int ready = poll(&request, 1, static_cast<int>(timeout.count()));
+            if (ready <= 0)
+                return false;
+
+            // cgroup files report a change as POLLERR together with POLLPRI.
+            if (request.revents & POLLPRI)
+                return true;
+
+            // An invalid descriptor, or an error on its own, means the source
+            // is gone; don't spin on it.
+            if (request.revents & (POLLNVAL | POLLERR))
+                std::this_thread::sleep_for(timeout);
+            return false;
+        }
+#else
+        (void)fd;
+#endif
+        std::this_thread::sleep_for(timeout);
+        return false;
+    }
+
+    // Sum of the "high" and "max" counts in a memory.events file.
+    static size_t read_events(int fd)
+    {
+        size_t total = 0;
+#if POOL_HAVE_POLL
+        char buffer[512];
+        const ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+        if (length <= 0)
+            return 0;
+        buffer[length] = '\0';
+
+        std::istringstream in(buffer);
+        std::string key;
+        size_t count;
+        while (in >> key >> count)
+        {
+            if (key == "high" || key == "max")
+                total += count;
+        }
+#else
+        (void)fd;
+#endif
+        return total;
+    }
+
+    Source m_source;
+    std::chrono::milliseconds m_interval;
+    std::mutex m_mutex;
+    std::vector<Watch> m_watches;
+    size_t m_nextId = 0;
+    std::atomic<bool> m_stop{false};
+    std::atomic<size_t> m_rises{0};
+    std::thread m_thread;
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "pool.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// An object pool whose slots all lie in one range of address space, reserved up
+// front for maxSlots objects. The reservation costs no memory: pages are
+// committed as the pool grows, doubling the committed part each time, so
+// objects never move and growth never scatters blocks across the heap.
+//
+// Since slot i lives at base + i, owns(p), index_of(p) and at(i) are a compare,
+// a subtraction or an addition, and free slots link to each other by 32-bit
+// index. Indices make compact handles: they stay valid for an object's lifetime
+// and fit in half a pointer.
+//
+// Never-used slots are carved in index order; freed slots are reused most
+// recently freed first. Growing past maxSlots throws std::bad_alloc.
+template <typename T>
+class ReservedPool
+{
+public:
+    using type = T;
+    using pointer = T*;
+    using index_type = uint32_t;
+
+    // Reserve address space for maxSlots objects, and commit at least
+    // minCommitBytes at a time.
+    explicit ReservedPool(size_t maxSlots, size_t minCommitBytes = 64 * 1024)
+        : m_base(nullptr)
+        , m_maxSlots(maxSlots)
+        , m_minCommitBytes(minCommitBytes)
+        , m_committedBytes(0)
+        , m_capacity(0)
+        , m_live(0)
+        , m_carved(0)
+        , m_nextFree(NoSlot)
+    {
+        assert(maxSlots > 0 && maxSlots < NoSlot); // Slots must be addressable by 32-bit index.
+
+        void* base = mmap(nullptr, reserved_bytes(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+            throw std::bad_alloc();
+        m_base = static_cast<Item*>(base);
+    }
+
+    // Unmaps the whole range. Live objects are not destroyed.
+    ~ReservedPool()
+    {
+        if (m_base != nullptr)
+            munmap(m_base, reserved_bytes());
+    }
+
+    ReservedPool(const ReservedPool&) = delete;
+    ReservedPool& operator=(const ReservedPool&) = delete;
+
+    ReservedPool(ReservedPool&& other) noexcept
+        : ReservedPool()
+    {
+        swap(other);
+    }
+
+    ReservedPool& operator=(ReservedPool&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    template <typename ...Ts>
+    [[nodiscard]] pointer construct(Ts&& ...args)
+    {
+        return new (allocate()) type(std::forward<Ts>(args)...);
+    }
+
+    void destroy(pointer p)
+    {
+        if (p == nullptr)
+            return;
+
+        p->~type();
+        Item* item = reinterpret_cast<Item*>(p);
+        item->m_next = m_nextFree;
+        m_nextFree = static_cast<index_type>(item - m_base);
+        m_live -= 1;
+    }
+
+    // Whether p points into one of the pool's slots, live or not.
+    bool owns(const void* p) const
+    {
+        const Item* item = static_cast<const Item*>(p);
+        return m_base <= item && item < m_base + m_carved;
+    }
+
+    index_type index_of(const type* p) const
+    {
+        assert(owns(p));
+        return static_cast<index_type>(reinterpret_cast<const Item*>(p) - m_base);
+    }
+
+    // The object in slot i, which must be live.
+    pointer at(index_type i) const
+    {
+        assert(i < m_carved);
+        return std::launder(reinterpret_cast<pointer>(&m_base[i].m_storage));
+    }
+
+    // Discard every object without running destructors, and give every
+    // committed page back to the OS. The address range stays reserved.
+    void release()
+    {
+        if (m_committedBytes > 0)
+        {
+            // Mapping fresh PROT_NONE pages over the range uncommits it.
+            void* base = mmap(m_base, m_committedBytes, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+            assert(base == m_base);
+            (void)base;
+        }
+
+        m_committedBytes = 0;
+        m_capacity = 0;
+        m_live = 0;
+        m_carved = 0;
+        m_nextFree = NoSlot;
+    }
+
+    // Calls f(T&) for every live object, in index order. Costs one walk of the
+    // free list plus a scan of the used slots.
+    template <typename F>
+    void visit_live(F&& f)
+    {
+        std::vector<bool> free(m_carved, false);
+        for (index_type i = m_nextFree; i != NoSlot; i = m_base[i].m_next)
+            free[i] = true;
+
+        for (size_t i = 0; i < m_carved; ++i)
+            if (!free[i])
+                f(*at(static_cast<index_type>(i)));
+    }
+
+    // Number of objects the committed pages can hold.
+    size_t capacity() const { return m_capacity; }
+
+    // Number of objects the reserved range can hold.
+    size_t max_size() const { return m_maxSlots; }
+
+    // Size counters, which may be read while another thread uses the pool.
+    PoolStats stats() const
+    {
+        const size_t capacity = m_capacity;
+        return { capacity, m_live.load(), capacity > 0 ? 1u : 0u, sizeof(Item) };
+    }
+
+private:
+    static constexpr index_type NoSlot = UINT32_MAX;
+
+    union Item
+    {
+        std::aligned_storage_t<sizeof(T), alignof(T)> m_storage;
+        index_type m_next;
+    };
+
+    static_assert(alignof(Item) <= 4096, "slots must not be aligned beyond a page");
+
+    // For moves: an empty pool with no reservation.
+    ReservedPool()
+        : m_base(nullptr)
+        , m_maxSlots(0)
+        , m_minCommitBytes(0)
+        , m_committedBytes(0)
+        , m_capacity(0)
+        , m_live(0)
+        , m_carved(0)
+        , m_nextFree(NoSlot)
+    {}
+
+    void swap(ReservedPool& other) noexcept
+    {
+        std::swap(m_base, other.m_base);
+        std::swap(m_maxSlots, other.m_maxSlots);
+        std::swap(m_minCommitBytes, other.m_minCommitBytes);
+        std::swap(m_committedBytes, other.m_committedBytes);
+        std::swap(m_carved, other.m_carved);
+        std::swap(m_nextFree, other.m_nextFree);
+
+        const size_t capacity = m_capacity;
+        m_capacity = other.m_capacity;
+        other.m_capacity = capacity;
+        const size_t live = m_live;
+        m_live = other.m_live;
+        other.m_live = live;
+    }
+
+    [[nodiscard]] void* allocate()
+    {
+        Item* item;
+        if (m_nextFree != NoSlot)
+        {
+            item = &m_base[m_nextFree];
+            m_nextFree = item->m_next;
+        }
+        else
+        {
+            if (m_carved == m_capacity)
+                commit();
+            item = &m_base[m_carved++];
+        }
+
+        m_live += 1;
+        return &item->m_storage;
+    }
+
+    // Commit as many bytes again as are committed already, and at least
+    // m_minCommitBytes, without going past the reservation.
+    void commit()
+    {
+        const size_t page = page_size();
+        size_t bytes = std::max(m_committedBytes, m_minCommitBytes);
+        bytes = std::min((bytes + page - 1) / page * page, reserved_bytes() - m_committedBytes);
+        if (bytes == 0 || mprotect(reinterpret_cast<std::byte*>(m_base) + m_committedBytes, bytes,
+                                   PROT_READ | PROT_WRITE) != 0)
+        {
+            throw std::bad_alloc();
+        }
+
+        m_committedBytes += bytes;
+        m_capacity = std::min(m_committedBytes / sizeof(Item), m_maxSlots);
+        if (m_capacity == m_carved)
+            commit(); // The new pages didn't complete a slot.
+    }
+
+    size_t reserved_bytes() const
+    {
+        const size_t page = page_size();
+        return (m_maxSlots * sizeof(Item) + page - 1) / page * page;
+    }
+
+    static size_t page_size()
+    {
+        static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    Item* m_base;
+    size_t m_maxSlots;
+    size_t m_minCommitBytes;
+    size_t m_committedBytes;
+    RelaxedCounter m_capacity;    // Slots in the committed pages.
+    RelaxedCounter m_live;
+    size_t m_carved;              // Slots from here on have never been used.
+    index_type m_nextFree;
+};
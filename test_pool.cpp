@@ -1,6 +1,18 @@
 #include "pool.h"
+#include "percpu_pool.h"
+#include "pressure_monitor.h"
+#include "reserved_pool.h"
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
 
 static constexpr size_t pool_init_block_size = 8;
 static constexpr size_t n_iterations = 1000000;
@@ -29,6 +41,15 @@ struct A : Base { std::byte data[8];   };
 struct B : Base { std::byte data[32];  };
 struct C : Base { std::byte data[64];  };
 struct D : Base { std::byte data[128]; };
+struct E : Base { std::byte data[256]; };
+
+// The same types, allocated through class-level new/delete routed to a pool.
+template <typename T>
+struct Pooled : T, PoolAllocated<Pooled<T>> {};
+
+// Derived from a pooled type but larger, so it must fall back to the heap.
+struct BigPooledA : Pooled<A> { std::byte extra[64]; };
+struct alignas(16) AlignedPooledA : Pooled<A> {};
 
 using DataMultipool = Multipool<A, B, C, D>;
 
@@ -183,6 +204,12 @@ void TestMassAlloc()
         Timer timer("Individual: ");
         MassAllocCRT<T>();
     }
+
+    // Test mass allocation of T, class-level new/delete routed to a pool
+    {
+        Timer timer("Class new: ");
+        MassAllocCRT<Pooled<T>>();
+    }
 }
 
 void TestMixedAlloc()
@@ -209,18 +236,2089 @@ void TestMixedAlloc()
     }
 }
 
-int main()
+// Allocate on one thread and delete on another, so every delete takes the
+// cross-thread path, then check the owning thread reuses the returned slots.
+void TestPoolAllocated()
 {
-    // Test mass allocation then deallocation of various object sizes.
-    // Exercises the Pool class.
-    TestMassAlloc<A>();
-    TestMassAlloc<B>();
-    TestMassAlloc<C>();
-    TestMassAlloc<D>();
+    std::cout << "Time to allocate " << n_iterations << " objects on one thread, delete on another:\n";
 
-    // Test pseudo-random mixed allocation/deallocation of multiple object types.
-    // Exercises the Multipool class.
-    TestMixedAlloc();
+    std::vector<Base*> ptrs;
+    ptrs.reserve(n_iterations);
+    {
+        Timer timer("Class new: ");
+        std::thread producer([&ptrs]{
+            for (size_t i = 0; i < n_iterations; ++i)
+                ptrs.emplace_back(new Pooled<A>());
+        });
+        producer.join();
+
+        std::thread consumer([&ptrs]{
+            for (Base* p : ptrs)
+                delete p;
+        });
+        consumer.join();
+    }
+
+    // The next thread adopts the producer's parked cache and reclaims the slots,
+    // so allocating the same number of objects again reuses them (apart from
+    // whatever was left unused in the producer's last block).
+    std::sort(ptrs.begin(), ptrs.end());
+    size_t reused = 0;
+    std::thread([&ptrs, &reused]{
+        std::vector<Base*> again;
+        again.reserve(n_iterations);
+        for (size_t i = 0; i < n_iterations; ++i)
+            again.emplace_back(new Pooled<A>());
+
+        for (Base* p : again)
+        {
+            reused += std::binary_search(ptrs.begin(), ptrs.end(), p);
+            delete p;
+        }
+    }).join();
+    assert(reused + 1024 >= n_iterations);
+
+    // Larger derived types go to the global heap.
+    Base* big = new BigPooledA();
+    delete big;
+
+    // Derived types of the same size get slots aligned for them.
+    static_assert(sizeof(AlignedPooledA) == sizeof(Pooled<A>) && alignof(AlignedPooledA) > alignof(Pooled<A>));
+    std::vector<Base*> aligned;
+    for (size_t i = 0; i < 64; ++i)
+    {
+        aligned.push_back(new AlignedPooledA());
+        assert(reinterpret_cast<uintptr_t>(aligned.back()) % alignof(AlignedPooledA) == 0);
+    }
+    for (Base* p : aligned)
+        delete p;
+}
+
+// Oversubscribe the CPUs with threads that repeatedly allocate a burst of
+// objects and free them again, and that all stay alive until the last one is
+// done. Per-thread caches each keep a burst's worth of slots parked, while
+// per-CPU caches share them between the threads running on that CPU.
+template <typename Alloc, typename Free>
+void OversubscribedChurn(size_t nThreads, size_t burst, Alloc alloc, Free free)
+{
+    const size_t rounds = n_iterations / nThreads / burst;
+    std::atomic<size_t> finished{0};
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nThreads; ++t)
+    {
+        threads.emplace_back([&]{
+            std::vector<Base*> ptrs;
+            ptrs.reserve(burst);
+            for (size_t round = 0; round < rounds; ++round)
+            {
+                for (size_t i = 0; i < burst; ++i)
+                    ptrs.emplace_back(alloc());
+
+                for (Base* p : ptrs)
+                    free(p);
+
+                ptrs.clear();
+                std::this_thread::yield();
+            }
+
+            finished++;
+            while (finished < nThreads)
+                std::this_thread::yield();
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void TestPerCpuPool()
+{
+    const size_t nThreads = 8 * std::max(std::thread::hardware_concurrency(), 4u);
+    const size_t burst = 256;
+
+    std::cout << "Time to allocate, free " << n_iterations << " objects of size " << sizeof(C)
+              << " on " << nThreads << " threads in bursts of " << burst << ":\n";
+
+    PerCpuPool<C> perCpu;
+    {
+        Timer timer("Per-CPU: ");
+        OversubscribedChurn(nThreads, burst,
+                            [&perCpu]{ return perCpu.construct(); },
+                            [&perCpu](Base* p){ perCpu.destroy(static_cast<C*>(p)); });
+    }
+
+    const size_t perThreadBefore = Pooled<C>::Slots::capacity();
+    {
+        Timer timer("Per-thread: ");
+        OversubscribedChurn(nThreads, burst,
+                            []{ return new Pooled<C>(); },
+                            [](Base* p){ delete p; });
+    }
+    const size_t perThreadReserved = Pooled<C>::Slots::capacity() - perThreadBefore;
+
+    std::cout << "Objects reserved (per-CPU " << (perCpu.uses_rseq() ? "rseq" : "locked") << "): "
+              << perCpu.capacity() << " vs " << perThreadReserved << " per-thread\n";
+}
+
+// Current resident set size, in MiB.
+size_t ResidentMiB()
+{
+    size_t pages = 0;
+    size_t resident = 0;
+    std::ifstream("/proc/self/statm") >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) / (1024 * 1024);
+}
+
+// Peak memory use of one producer/consumer run.
+struct RebalancingPeak
+{
+    size_t m_live;      // Objects allocated and not yet deleted.
+    size_t m_reserved;  // Slots held by the caches.
+    size_t m_rssGrowth; // In MiB.
+};
+
+// Producer threads take turns building batches of objects that consumer
+// threads delete, so every free is remote and lands on the producer's list
+// while that producer sits idle. Rebalancing lets the busy producer reuse the
+// slots freed back to the idle ones instead of growing. A sampler thread
+// records the peak number of live objects and reserved slots.
+template <bool Rebalance>
+RebalancingPeak ProduceConsume(const char* label, size_t nProducers, size_t nConsumers)
+{
+    using Slots = ThreadLocalPool<E, Rebalance>;
+    const size_t batch = 1000;
+    const size_t burst = 50000;
+    const size_t rounds = n_iterations / burst;
+    const size_t maxQueued = 16;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<E*>> queue;
+    bool produced = false;
+
+    std::atomic<size_t> live{0};
+    std::atomic<bool> finished{false};
+    RebalancingPeak peak{0, 0, 0};
+    std::thread sampler([&] {
+        while (!finished)
+        {
+            peak.m_live = std::max(peak.m_live, live.load());
+            peak.m_reserved = std::max(peak.m_reserved, Slots::stats().m_capacity);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    const size_t rssBefore = ResidentMiB();
+    {
+        Timer timer(label);
+        std::vector<std::thread> consumers;
+        for (size_t c = 0; c < nConsumers; ++c)
+        {
+            consumers.emplace_back([&] {
+                for (;;)
+                {
+                    std::vector<E*> ptrs;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&] { return !queue.empty() || produced; });
+                        if (queue.empty())
+                            return;
+
+                        ptrs = std::move(queue.front());
+                        queue.pop_front();
+                    }
+                    changed.notify_all();
+
+                    for (E* p : ptrs)
+                    {
+                        p->~E();
+                        Slots::deallocate(p);
+                    }
+                    live -= ptrs.size();
+                }
+            });
+        }
+
+        std::atomic<size_t> turn{0};
+        std::vector<std::thread> producers;
+        for (size_t t = 0; t < nProducers; ++t)
+        {
+            producers.emplace_back([&, t] {
+                for (size_t round = t; round < rounds; round += nProducers)
+                {
+                    while (turn != round)
+                        std::this_thread::yield();
+
+                    for (size_t made = 0; made < burst; made += batch)
+                    {
+                        std::vector<E*> ptrs;
+                        ptrs.reserve(batch);
+                        for (size_t i = 0; i < batch; ++i)
+                            ptrs.push_back(new (Slots::allocate()) E());
+                        live += batch;
+
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&] { return queue.size() < maxQueued; });
+                        queue.push_back(std::move(ptrs));
+                        lock.unlock();
+                        changed.notify_all();
+                    }
+                    turn++;
+                }
+
+                // Stay alive, holding on to the cache, until every turn is over.
+                while (turn < rounds)
+                    std::this_thread::yield();
+            });
+        }
+
+        for (auto& producer : producers)
+            producer.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            produced = true;
+        }
+        changed.notify_all();
+        for (auto& consumer : consumers)
+            consumer.join();
+    }
+    finished = true;
+    sampler.join();
+
+    const size_t rssAfter = ResidentMiB();
+    peak.m_reserved = std::max(peak.m_reserved, Slots::stats().m_capacity);
+    peak.m_rssGrowth = rssAfter - std::min(rssBefore, rssAfter);
+
+    // Consumers free remotely, so live counts only drop as caches take slots back.
+    const PoolStats stats = Slots::stats();
+    assert(stats.m_live <= stats.m_capacity);
+    return peak;
+}
+
+void TestRebalancing()
+{
+    const size_t nProducers = 4;
+    const size_t nConsumers = 2;
+
+    std::cout << "Time to produce, consume " << n_iterations << " objects of size " << sizeof(E)
+              << " with " << nProducers << " producers taking turns and " << nConsumers << " consumers:\n";
+
+    const RebalancingPeak off = ProduceConsume<false>("Per-thread: ", nProducers, nConsumers);
+    const RebalancingPeak on = ProduceConsume<true>("Rebalanced: ", nProducers, nConsumers);
+
+    // Without rebalancing every producer grows its own cache to the peak.
+    assert(on.m_reserved < off.m_reserved);
+
+    std::cout << "Peak live objects: " << off.m_live << " per-thread vs " << on.m_live << " rebalanced\n"
+              << "Peak reserved slots: " << off.m_reserved << " per-thread vs " << on.m_reserved << " rebalanced\n"
+              << "RSS growth: " << off.m_rssGrowth << " MiB per-thread vs " << on.m_rssGrowth << " MiB rebalanced\n";
+}
+
+// A node with a non-trivial destructor, to check that rollback runs it.
+struct ParseNode
+{
+    ParseNode() { ++live; }
+    ~ParseNode() { --live; }
+
+    static inline size_t live = 0;
+    std::byte data[24];
+};
+
+// Simulate a backtracking parser: each alternative speculatively builds some
+// nodes, and most alternatives fail and throw their nodes away.
+void TestCheckpoint()
+{
+    const size_t nodesPerAlternative = 16;
+    const size_t alternatives = n_iterations / nodesPerAlternative;
+
+    std::cout << "Time to build, discard " << n_iterations << " speculative objects of size "
+              << sizeof(ParseNode) << ":\n";
+
+    // Discard each failed alternative by rolling back to a checkpoint.
+    {
+        Timer timer("Rollback: ");
+        Pool<ParseNode> pool(pool_init_block_size);
+        for (size_t i = 0; i < alternatives; ++i)
+        {
+            const auto checkpoint = pool.mark();
+            for (size_t j = 0; j < nodesPerAlternative; ++j)
+                (void)pool.construct();
+
+            // Alternatives that succeed keep their nodes.
+            if (i % 8 != 0)
+                pool.rollback(checkpoint);
+        }
+
+        assert(ParseNode::live == (alternatives + 7) / 8 * nodesPerAlternative);
+        pool.rollback(0);
+        assert(ParseNode::live == 0);
+    }
+
+    // Discard each failed alternative by destroying its nodes one by one.
+    {
+        Timer timer("Individual: ");
+        Pool<ParseNode> pool(pool_init_block_size);
+        std::vector<ParseNode*> kept;
+        std::vector<ParseNode*> nodes;
+        for (size_t i = 0; i < alternatives; ++i)
+        {
+            for (size_t j = 0; j < nodesPerAlternative; ++j)
+                nodes.push_back(pool.construct());
+
+            if (i % 8 != 0)
+            {
+                for (ParseNode* node : nodes)
+                    pool.destroy(node);
+            }
+            else
+            {
+                kept.insert(kept.end(), nodes.begin(), nodes.end());
+            }
+            nodes.clear();
+        }
+
+        for (ParseNode* node : kept)
+            pool.destroy(node);
+        assert(ParseNode::live == 0);
+    }
+
+    // Rolling back reuses the same slots, and objects freed inside a scope may
+    // be reused inside it.
+    {
+        Pool<ParseNode> pool(pool_init_block_size);
+        ParseNode* before = pool.construct();
+        const auto outer = pool.mark();
+        ParseNode* first = pool.construct();
+        pool.destroy(pool.construct());
+        const auto inner = pool.mark();
+        (void)pool.construct();
+        pool.rollback(inner);
+        assert(ParseNode::live == 2);
+        pool.rollback(outer);
+        assert(ParseNode::live == 1);
+        ParseNode* again = pool.construct();
+        assert(again == first);
+        pool.destroy(again);
+        pool.destroy(before);
+    }
+
+    // Objects from before the mark may be destroyed in a scope, even a nested
+    // one. Their slots aren't reused in it, and stay free after the rollback.
+    {
+        Pool<ParseNode> pool(pool_init_block_size);
+        ParseNode* first = pool.construct();
+        ParseNode* second = pool.construct();
+        const auto checkpoint = pool.mark();
+        pool.destroy(first);
+        ParseNode* inScope = pool.construct();
+        assert(inScope != first);
+        (void)pool.mark();
+        pool.destroy(second);
+        ParseNode* inNested = pool.construct();
+        assert(inNested != second);
+        pool.rollback(checkpoint);
+        assert(ParseNode::live == 0 && pool.stats().m_live == 0);
+
+        ParseNode* a = pool.construct();
+        ParseNode* b = pool.construct();
+        assert((a == first && b == second) || (a == second && b == first));
+        pool.destroy(a);
+        pool.destroy(b);
+    }
+
+    // Rolling back the nested scope first still keeps such a slot from the
+    // enclosing scope, whose mark postdates it too.
+    {
+        Pool<ParseNode> pool(pool_init_block_size);
+        ParseNode* before = pool.construct();
+        const auto outer = pool.mark();
+        const auto inner = pool.mark();
+        pool.destroy(before);
+        pool.rollback(inner);
+        assert(pool.stats().m_live == 0);
+        ParseNode* scoped = pool.construct();
+        assert(scoped != before);
+        pool.rollback(outer);
+        assert(ParseNode::live == 0 && pool.stats().m_live == 0);
+
+        size_t visited = 0;
+        pool.visit_live([&visited](ParseNode&) { ++visited; });
+        assert(visited == 0);
+        ParseNode* again = pool.construct();
+        assert(again == before || again == scoped);
+        pool.destroy(again);
+    }
+
+    // Committing a scope keeps its objects and hands back the free slots set
+    // aside by the mark, without the checkpoints piling up.
+    {
+        Pool<ParseNode> pool(pool_init_block_size);
+        ParseNode* before = pool.construct();
+        ParseNode* freed = pool.construct();
+        pool.destroy(freed);
+        for (size_t i = 0; i < 4; ++i)
+        {
+            const auto checkpoint = pool.mark();
+            assert(checkpoint == 0);
+            pool.commit(checkpoint);
+        }
+
+        const auto checkpoint = pool.mark();
+        ParseNode* kept = pool.construct();
+        assert(kept != freed);
+        pool.destroy(before);
+        pool.commit(checkpoint);
+        assert(ParseNode::live == 1 && pool.stats().m_live == 1);
+
+        const size_t capacity = pool.capacity();
+        ParseNode* a = pool.construct();
+        ParseNode* b = pool.construct();
+        assert((a == before && b == freed) || (a == freed && b == before));
+        assert(pool.capacity() == capacity);
+        pool.destroy(a);
+        pool.destroy(b);
+        pool.destroy(kept);
+    }
+}
+
+// Build short arrays of children (2 to 16 entries), free every other one, build
+// the same number again and free everything.
+template <typename Alloc, typename Free>
+void ChildArrays(Alloc alloc, Free free)
+{
+    std::vector<std::pair<A*, size_t>> arrays;
+    size_t total = 0;
+    for (size_t i = 0; total < n_iterations; ++i)
+    {
+        const size_t n = 2 + i % 15;
+        arrays.emplace_back(alloc(n), n);
+        total += n;
+    }
+
+    for (size_t i = 0; i < arrays.size(); i += 2)
+        free(arrays[i].first, arrays[i].second);
+
+    for (size_t i = 0; i < arrays.size(); i += 2)
+    {
+        const size_t n = 2 + (i * 7) % 15;
+        arrays[i] = { alloc(n), n };
+    }
+
+    for (auto& [children, n] : arrays)
+        free(children, n);
+}
+
+void TestContiguous()
+{
+    std::cout << "Time to allocate, free arrays of 2-16 objects of size " << sizeof(A) << ":\n";
+
+    {
+        Timer timer("Pooled: ");
+        Pool<A> pool(pool_init_block_size);
+        ChildArrays(
+            [&pool](size_t n) {
+                A* children = pool.allocate_contiguous(n);
+                std::uninitialized_default_construct_n(children, n);
+                return children;
+            },
+            [&pool](A* children, size_t n) {
+                std::destroy_n(children, n);
+                pool.deallocate_contiguous(children, n);
+            });
+    }
+
+    {
+        Timer timer("Individual: ");
+        ChildArrays([](size_t n) { return new A[n]; },
+                    [](A* children, size_t) { delete[] children; });
+    }
+
+    // Arrays come from a single block, and freed arrays are reused, shortest fit
+    // first.
+    {
+        Pool<A> pool(pool_init_block_size);
+        A* small = pool.allocate_contiguous(3);
+        A* big = pool.allocate_contiguous(16); // Doesn't fit the first block's tail.
+        pool.deallocate_contiguous(big, 16);
+        A* tail = pool.allocate_contiguous(5);
+        assert(tail == small + 3);
+        A* head = pool.allocate_contiguous(11);
+        assert(head == big);
+        A* rest = pool.allocate_contiguous(5);
+        assert(rest == big + 11);
+        pool.deallocate_contiguous(small, 3);
+        pool.deallocate_contiguous(tail, 5);
+        pool.deallocate_contiguous(head, 11);
+        pool.deallocate_contiguous(rest, 5);
+    }
+
+    // Arrays longer than the longest free run are always carved, never taken
+    // from a shorter free run.
+    {
+        Pool<A> pool(64);
+        A* freed = pool.allocate_contiguous(4);
+        A* live = pool.allocate_contiguous(4);
+        pool.deallocate_contiguous(freed, 4);
+        A* longer = pool.allocate_contiguous(36);
+        assert(longer + 36 <= live || live + 4 <= longer);
+        pool.deallocate_contiguous(longer, 36);
+        pool.deallocate_contiguous(live, 4);
+    }
+}
+
+// Decode a stream of type tags the way a deserializer would: each tag in [0,3]
+// creates an object of that type, 4 destroys the last four objects created.
+// `create` and `destroy` map a tag to the type-specific call.
+template <typename Create, typename Destroy>
+void DecodeTags(const std::array<int, n_iterations>& tags, Create create, Destroy destroy)
+{
+    std::vector<std::pair<int, Base*>> objects;
+    objects.reserve(n_iterations);
+
+    for (size_t i = 0; i < n_iterations; ++i)
+    {
+        if (tags[i] < 4)
+        {
+            objects.emplace_back(tags[i], create(tags[i]));
+        }
+        else if (objects.size() > 4)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                destroy(objects.back().first, objects.back().second);
+                objects.pop_back();
+            }
+        }
+    }
+
+    for (auto [tag, p] : objects)
+        destroy(tag, p);
+}
+
+void TestConstructByIndex()
+{
+    std::array<int, n_iterations> tags;
+    for (size_t i = 0; i < n_iterations; ++i)
+        tags[i] = rand() % 5;
+
+    std::cout << "Time to construct, destroy " << n_iterations << " objects by runtime type tag:\n";
+    DataMultipool& mp = MultipoolInstance::get();
+
+    {
+        Timer timer("Jump table: ");
+        DecodeTags(tags,
+                   [&mp](int tag) { return mp.construct_by_index<Base>(tag); },
+                   [&mp](int tag, Base* p) { mp.destroy_by_index(tag, p); });
+        mp.release_all();
+    }
+
+    {
+        Timer timer("Switch: ");
+        DecodeTags(tags,
+                   [&mp](int tag) -> Base* {
+                       switch (tag)
+                       {
+                           case 0: return mp.construct<A>();
+                           case 1: return mp.construct<B>();
+                           case 2: return mp.construct<C>();
+                           default: return mp.construct<D>();
+                       }
+                   },
+                   [&mp](int tag, Base* p) {
+                       switch (tag)
+                       {
+                           case 0: mp.destroy(static_cast<A*>(p)); break;
+                           case 1: mp.destroy(static_cast<B*>(p)); break;
+                           case 2: mp.destroy(static_cast<C*>(p)); break;
+                           default: mp.destroy(static_cast<D*>(p)); break;
+                       }
+                   });
+        mp.release_all();
+    }
+
+    static_assert(DataMultipool::index_of<C>() == 2);
+    const size_t size = mp.visit_type(DataMultipool::index_of<C>(), [](auto tag) {
+        return sizeof(typename decltype(tag)::type);
+    });
+    assert(size == sizeof(C));
+}
+
+// Visit every live object of a Multipool after a random mix of construction and
+// destruction, and compare with scanning a plain array of the same length.
+void TestVisitLive()
+{
+    DataMultipool& mp = MultipoolInstance::get();
+    std::vector<std::pair<int, Base*>> objects;
+    for (size_t i = 0; i < n_iterations; ++i)
+    {
+        const int tag = rand() % 5;
+        if (tag < 4)
+            objects.emplace_back(tag, mp.construct_by_index<Base>(tag));
+        else if (!objects.empty())
+        {
+            // Destroy a random object so the free slots are scattered.
+            std::swap(objects[rand() % objects.size()], objects.back());
+            mp.destroy_by_index(objects.back().first, objects.back().second);
+            objects.pop_back();
+        }
+    }
+
+    std::cout << "Time to visit " << objects.size() << " live objects:\n";
+
+    std::array<size_t, 4> counts{};
+    auto count = overloaded{
+        [&counts](A& a) { counts[0] += static_cast<size_t>(a.data[0]) + 1; },
+        [&counts](B& b) { counts[1] += static_cast<size_t>(b.data[0]) + 1; },
+        [&counts](C& c) { counts[2] += static_cast<size_t>(c.data[0]) + 1; },
+        [&counts](D& d) { counts[3] += static_cast<size_t>(d.data[0]) + 1; },
+    };
+    {
+        Timer timer("Visit: ");
+        mp.visit_live(count);
+    }
+    assert(counts[0] + counts[1] + counts[2] + counts[3] == objects.size());
+
+    counts = {};
+    {
+        Timer timer("Parallel: ");
+        mp.visit_live(count, true);
+    }
+    assert(counts[0] + counts[1] + counts[2] + counts[3] == objects.size());
+
+    {
+        std::vector<A> array(objects.size());
+        size_t total = 0;
+        {
+            Timer timer("Array scan: ");
+            for (A& a : array)
+                total += static_cast<size_t>(a.data[0]) + 1;
+        }
+        assert(total == array.size());
+    }
+
+    mp.release_all();
+}
+
+// Run the mixed workload against a PolyPool and a Multipool of the same
+// hierarchy, and compare speed and the memory each ends up holding.
+void TestPolyPool()
+{
+    std::array<int, n_iterations> tags;
+    for (size_t i = 0; i < n_iterations; ++i)
+        tags[i] = rand() % 5;
+
+    std::cout << "Time to construct, destroy " << n_iterations << " objects of mixed types:\n";
+
+    size_t polyBytes = 0;
+    {
+        PolyPool<Base, A, B, C, D> pool(pool_init_block_size);
+        {
+            Timer timer("PolyPool: ");
+            DecodeTags(tags,
+                       [&pool](int tag) -> Base* {
+                           switch (tag)
+                           {
+                               case 0: return pool.construct<A>();
+                               case 1: return pool.construct<B>();
+                               case 2: return pool.construct<C>();
+                               default: return pool.construct<D>();
+                           }
+                       },
+                       [&pool](int, Base* p) { pool.destroy(p); });
+        }
+        polyBytes = pool.capacity() * pool.slot_size;
+    }
+
+    size_t multiBytes = 0;
+    {
+        DataMultipool mp(pool_init_block_size);
+        {
+            Timer timer("Multipool: ");
+            DecodeTags(tags,
+                       [&mp](int tag) { return mp.construct_by_index<Base>(tag); },
+                       [&mp](int tag, Base* p) { mp.destroy_by_index(tag, p); });
+        }
+        multiBytes = mp.get<A>().capacity() * sizeof(A) + mp.get<B>().capacity() * sizeof(B)
+                   + mp.get<C>().capacity() * sizeof(C) + mp.get<D>().capacity() * sizeof(D);
+    }
+
+    std::cout << "Bytes held: " << polyBytes << " PolyPool vs " << multiBytes << " Multipool\n";
+}
+
+// An object whose destructor does real work, like scrubbing what it owns.
+struct Expensive
+{
+    ~Expensive()
+    {
+        for (std::byte& b : data)
+            sink = sink + static_cast<size_t>(b);
+        destroyed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::byte data[256]{};
+    static inline volatile size_t sink = 0;
+    static inline std::atomic<size_t> destroyed{0};
+};
+
+// Compare destroying objects inline with queueing them and draining the queue
+// later, off the request path.
+void TestDeferredDestroy()
+{
+    const size_t n = n_iterations / 8;
+    std::cout << "Time to destroy " << n << " objects with expensive destructors:\n";
+
+    Pool<Expensive> pool(pool_init_block_size);
+    std::vector<Expensive*> objects(n);
+
+    for (auto& p : objects)
+        p = pool.construct();
+    Expensive::destroyed = 0;
+    {
+        Timer timer("Inline: ");
+        for (auto p : objects)
+            pool.destroy(p);
+    }
+    assert(Expensive::destroyed == n);
+
+    for (auto& p : objects)
+        p = pool.construct();
+    Expensive::destroyed = 0;
+    {
+        Timer timer("Deferred: ");
+        for (auto p : objects)
+            pool.destroy_deferred(p);
+    }
+    assert(Expensive::destroyed == 0);
+    {
+        Timer timer("Drain: ");
+        pool.drain();
+    }
+    assert(Expensive::destroyed == n);
+
+    // Drained slots are reused before the pool grows.
+    const size_t capacity = pool.capacity();
+    for (auto& p : objects)
+        p = pool.construct();
+    assert(pool.capacity() == capacity);
+
+    // Queued destructions still run when the pool goes away undrained.
+    Expensive::destroyed = 0;
+    {
+        Pool<Expensive> scratch;
+        scratch.destroy_deferred(scratch.construct());
+    }
+    assert(Expensive::destroyed == 1);
+
+    // A shared pool drained by a background worker.
+    Expensive::destroyed = 0;
+    {
+        PerCpuPool<Expensive> shared;
+        shared.drain_in_background();
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; ++t)
+        {
+            threads.emplace_back([&shared, n]{
+                for (size_t i = 0; i < n / 4; ++i)
+                    shared.destroy_deferred(shared.construct());
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+    }
+    assert(Expensive::destroyed == n / 4 * 4);
+}
+
+// Counts the blocks a growth policy is asked to size.
+template <typename Policy>
+struct CountingGrowth : Policy
+{
+    size_t next_block_size(size_t lastBlockSize, size_t capacity)
+    {
+        ++growths;
+        return Policy::next_block_size(lastBlockSize, capacity);
+    }
+
+    static inline size_t growths = 0;
+};
+
+// Keep allocating `perTick` objects and then idling for `idle`, `ticks` times.
+template <typename P>
+void AllocateTicks(P& pool, std::vector<A*>& live, size_t ticks, size_t perTick, std::chrono::microseconds idle)
+{
+    for (size_t t = 0; t < ticks; ++t)
+    {
+        for (size_t i = 0; i < perTick; ++i)
+            live.push_back(pool.construct());
+
+        const auto until = std::chrono::steady_clock::now() + idle;
+        while (std::chrono::steady_clock::now() < until)
+            ;
+    }
+}
+
+// Run a steady and a bursty workload under the given growth policy, and report
+// the number of blocks allocated and the slots left idle at the end.
+template <typename Policy>
+void GrowthWorkloads(const char* label)
+{
+    using GrowthPool = Pool<A, 2, 65536, CountingGrowth<Policy>>;
+
+    {
+        CountingGrowth<Policy>::growths = 0;
+        GrowthPool pool(pool_init_block_size);
+        std::vector<A*> live;
+        AllocateTicks(pool, live, 200, 500, std::chrono::microseconds(200));
+        std::cout << std::setw(12) << label << "steady: " << CountingGrowth<Policy>::growths << " blocks, "
+                  << pool.capacity() - live.size() << " idle slots\n";
+    }
+
+    {
+        CountingGrowth<Policy>::growths = 0;
+        GrowthPool pool(pool_init_block_size);
+        std::vector<A*> live;
+        for (size_t phase = 0; phase < 4; ++phase)
+        {
+            AllocateTicks(pool, live, 1, n_iterations / 8, std::chrono::microseconds(0));
+            AllocateTicks(pool, live, 50, 20, std::chrono::microseconds(200));
+        }
+        std::cout << std::setw(12) << label << "bursty: " << CountingGrowth<Policy>::growths << " blocks, "
+                  << pool.capacity() - live.size() << " idle slots\n";
+    }
+}
+
+// Compare fixed geometric growth with growth sized by the allocation rate.
+void TestAdaptiveGrowth()
+{
+    std::cout << "Blocks allocated and idle slots at the end, for objects of size " << sizeof(A) << ":\n";
+    GrowthWorkloads<GeometricGrowth<2>>("Geometric: ");
+    GrowthWorkloads<AdaptiveGrowth<>>("Adaptive: ");
+}
+
+using ProfiledPool = Pool<B, 2, 1024, GeometricGrowth<2>, HeapProfiler>;
+
+// A call site the profiler should find in its stacks, and the same call site
+// without a profiler for comparison. Not templates: LTO would hide the symbols
+// of template instantiations from backtraces.
+__attribute__((noinline)) B* ProfiledAllocSite(ProfiledPool& pool)
+{
+    B* p = pool.construct();
+    asm volatile("" ::: "memory"); // Keep this frame out of tail position.
+    return p;
+}
+
+__attribute__((noinline)) B* ProfiledAllocSite(Pool<B>& pool)
+{
+    B* p = pool.construct();
+    asm volatile("" ::: "memory");
+    return p;
+}
+
+// Measure the cost of sampling construct() call stacks, and of a profiler that
+// is attached but never samples, and check the profile names the call site.
+void TestHeapProfiler()
+{
+    std::cout << "Time to allocate, free " << n_iterations << " objects of size " << sizeof(B)
+              << ", sampling 1 in 1024 stacks:\n";
+
+    auto churn = [](auto& pool) {
+        std::vector<B*> objects;
+        objects.reserve(n_iterations);
+        for (size_t i = 0; i < n_iterations; ++i)
+            objects.push_back(ProfiledAllocSite(pool));
+        for (size_t i = 0; i < n_iterations / 2; ++i)
+            pool.destroy(objects[i]);
+        return objects;
+    };
+
+    // Fault in the heap first, so the first timed run doesn't pay for it.
+    {
+        Pool<B> pool(pool_init_block_size);
+        churn(pool);
+    }
+
+    {
+        Pool<B> pool(pool_init_block_size);
+        Timer timer("Unprofiled: ");
+        churn(pool);
+    }
+
+    // Only the unsampled paths: the countdown and the filter lookup.
+    {
+        ProfiledPool pool(pool_init_block_size, HeapProfiler(std::numeric_limits<size_t>::max()));
+        Timer timer("Unsampled: ");
+        churn(pool);
+        assert(pool.observer().live_samples() == 0);
+    }
+
+    ProfiledPool pool(pool_init_block_size, HeapProfiler(1024));
+    const HeapProfiler& profiler = pool.observer();
+    {
+        Timer timer("Profiled: ");
+        churn(pool);
+    }
+
+    // About half of the sampled objects are still live.
+    const size_t samples = n_iterations / 1024;
+    assert(profiler.live_samples() > samples / 2 - 2 && profiler.live_samples() < samples / 2 + 2);
+
+    std::ostringstream live;
+    profiler.write_folded(live);
+    std::ostringstream total;
+    profiler.write_folded(total, false);
+    assert(live.str().find("ProfiledAllocSite") != std::string::npos);
+    assert(total.str().find("ProfiledAllocSite") != std::string::npos);
+
+    pool.release();
+    assert(profiler.live_samples() == 0);
+}
+
+// Counts every event a pool reports.
+struct CountingObserver : PoolObserver
+{
+    void on_grow(const void*, size_t slots, size_t bytes)
+    {
+        ++grows;
+        grownBytes += bytes;
+        assert(bytes == slots * sizeof(B));
+    }
+
+    void on_release(const void*, size_t, size_t bytes)
+    {
+        ++releases;
+        releasedBytes += bytes;
+    }
+
+    void on_construct(const void*) { ++constructs; }
+    void on_destroy(const void*) { ++destroys; }
+
+    template <typename Pred>
+    void on_discard(Pred&&) { ++discards; }
+
+    size_t grows = 0;
+    size_t grownBytes = 0;
+    size_t releases = 0;
+    size_t releasedBytes = 0;
+    size_t constructs = 0;
+    size_t destroys = 0;
+    size_t discards = 0;
+};
+
+// Check the events a pool reports to its observer, and that the default observer
+// costs neither space nor time.
+void TestObserver()
+{
+    static_assert(std::is_empty_v<PoolObserver>);
+    static_assert(sizeof(Pool<B>) == sizeof(Pool<B, 2, 1024, GeometricGrowth<2>, PrintObserver>));
+
+    std::cout << "Time to allocate, free " << n_iterations << " objects of size " << sizeof(B)
+              << " with an observer:\n";
+
+    auto churn = [](auto& pool) {
+        std::vector<B*> objects;
+        objects.reserve(n_iterations);
+        for (size_t i = 0; i < n_iterations; ++i)
+            objects.push_back(pool.construct());
+        for (B* p : objects)
+            pool.destroy(p);
+    };
+
+    {
+        Pool<B> pool(pool_init_block_size);
+        Timer timer("Default observer: ");
+        churn(pool);
+    }
+
+    Pool<B, 2, 1024, GeometricGrowth<2>, CountingObserver> pool(pool_init_block_size);
+    {
+        Timer timer("Counting observer: ");
+        churn(pool);
+    }
+
+    const CountingObserver& events = pool.observer();
+    assert(events.constructs == n_iterations && events.destroys == n_iterations);
+    assert(events.grows == pool.stats().m_blocks && events.grownBytes == pool.capacity() * sizeof(B));
+
+    const auto checkpoint = pool.mark();
+    for (size_t i = 0; i < 10; ++i)
+        (void)pool.construct();
+    pool.rollback(checkpoint);
+    assert(events.discards == 1 && events.destroys == n_iterations);
+
+    pool.release();
+    assert(events.discards == 2);
+    assert(events.releases == events.grows && events.releasedBytes == events.grownBytes);
+
+    // Assigning over a pool gives its blocks up as release() does, running the
+    // destructors of its recycled and deferred objects.
+    BlockCache cache;
+    Pool<ParseNode> target(pool_init_block_size);
+    target.set_block_cache(&cache);
+    target.recycle(target.construct());
+    target.destroy_deferred(target.construct());
+    Pool<ParseNode> source(pool_init_block_size);
+    const size_t capacity = source.capacity();
+    target = std::move(source);
+    assert(ParseNode::live == 0 && cache.bytes() > 0);
+    assert(target.capacity() == capacity && source.capacity() == 0 && source.stats().m_blocks == 0);
+}
+
+// Build objects in per-thread pools and merge the pools into one, then hand
+// half of the spare capacity to another thread with steal_free().
+void TestMerge()
+{
+    using Record = std::array<size_t, 4>;
+    const size_t threads = 4;
+    const size_t perThread = n_iterations / threads;
+
+    std::vector<Pool<Record>> pools;
+    for (size_t t = 0; t < threads; ++t)
+        pools.emplace_back(pool_init_block_size);
+
+    std::vector<std::vector<Record*>> objects(threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t] {
+            for (size_t i = 0; i < perThread; ++i)
+                objects[t].push_back(pools[t].construct(Record{t, i, 0, 0}));
+            // Leave free slots on each pool's free list.
+            for (size_t i = 0; i < perThread; i += 3)
+                pools[t].destroy(objects[t][i]);
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+
+    Pool<Record> merged(pool_init_block_size);
+    size_t capacity = merged.capacity();
+    for (const auto& pool : pools)
+        capacity += pool.capacity();
+
+    std::cout << "Time to merge " << threads << " pools of " << perThread << " objects:\n";
+    {
+        Timer timer("Merge: ");
+        for (auto& pool : pools)
+            merged.merge(std::move(pool));
+    }
+
+    const size_t live = threads * (perThread - (perThread + 2) / 3);
+    assert(merged.capacity() == capacity && merged.stats().m_live == live);
+    for (const auto& pool : pools)
+        assert(pool.capacity() == 0 && pool.stats().m_live == 0);
+
+    size_t intact = 0;
+    merged.visit_live([&intact](Record& r) { intact += r[1] % 3 != 0 && r[0] < threads; });
+    assert(intact == live);
+
+    // Every free slot of the merged pools is used before the pool grows.
+    std::vector<Record*> filled;
+    for (size_t i = live; i < capacity; ++i)
+        filled.push_back(merged.construct());
+    assert(merged.capacity() == capacity);
+
+    for (size_t t = 0; t < threads; ++t)
+        for (size_t i = 0; i < perThread; ++i)
+            if (i % 3 != 0)
+                merged.destroy(objects[t][i]);
+    for (Record* p : filled)
+        merged.destroy(p);
+
+    Pool<Record> spare = merged.steal_free(capacity / 2);
+    assert(spare.capacity() >= capacity / 2 && spare.capacity() + merged.capacity() == capacity);
+
+    const size_t stolen = spare.capacity();
+    std::thread([&spare, stolen] {
+        for (size_t i = 0; i < stolen; ++i)
+            (void)spare.construct();
+        assert(spare.capacity() == stolen);
+    }).join();
+
+    // Merging a pool that carved nothing from its block leaves a free range
+    // starting at that block's first slot; trim() must drop it with the block.
+    {
+        Pool<Record, 2, 64> small(pool_init_block_size);
+        for (size_t i = 0; i < 4; ++i)
+            (void)small.construct();
+        small.merge(Pool<Record, 2, 64>(pool_init_block_size));
+        small.trim();
+        for (size_t i = 0; i < 64; ++i)
+            (void)small.construct();
+        assert(small.stats().m_live == 68);
+
+        // A pool left with no blocks can take another's and open a scope.
+        small.release();
+        Pool<Record, 2, 64> other(pool_init_block_size);
+        Record* kept = other.construct();
+        small.merge(std::move(other));
+        const auto checkpoint = small.mark();
+        Record* scoped = small.construct();
+        assert(scoped != kept && small.capacity() > pool_init_block_size);
+        small.rollback(checkpoint);
+        assert(small.stats().m_live == 1);
+    }
+
+    // Observers follow blocks from pool to pool.
+    {
+        using Mapped = Pool<Record, 2, 1024, GeometricGrowth<2>, BlockMapObserver>;
+        Mapped mapped(pool_init_block_size);
+        Mapped other(pool_init_block_size);
+        Record* p = other.construct();
+        mapped.merge(std::move(other));
+        assert(mapped.observer().owns(p) && !other.observer().owns(p));
+
+        mapped.destroy(p);
+        Mapped spare = mapped.steal_free(1);
+        assert(spare.observer().owns(p) && !mapped.observer().owns(p));
+    }
+
+    // Stolen blocks go back to the source pool's block cache.
+    {
+        BlockCache cache;
+        Pool<Record> cached(pool_init_block_size);
+        cached.set_block_cache(&cache);
+        for (size_t i = 0; i < 4 * pool_init_block_size; ++i)
+            (void)cached.construct();
+        cached.reset();
+        assert(cache.bytes() == 0);
+        {
+            Pool<Record> spare = cached.steal_free(1);
+            assert(spare.capacity() > 0);
+        }
+        assert(cache.bytes() > 0);
+    }
+
+    // The never-used end of a merged block is not known to be zero once it has
+    // been handed out, even after a reset() carves the block again.
+    {
+        Pool<Record> zeroed(pool_init_block_size);
+        Pool<Record> other(pool_init_block_size);
+        (void)other.construct();
+        zeroed.merge(std::move(other));
+        for (size_t i = 0; i < 2 * pool_init_block_size - 1; ++i)
+            zeroed.construct()->fill(0xff);
+        assert(zeroed.capacity() == 2 * pool_init_block_size);
+
+        zeroed.reset();
+        for (size_t i = 0; i < 2 * pool_init_block_size; ++i)
+        {
+            const Record* r = zeroed.construct_zeroed();
+            assert(std::all_of(r->begin(), r->end(), [](size_t v) { return v == 0; }));
+        }
+    }
+}
+
+// Fill sub-pools of a Multipool and release them frame after frame, with and
+// without a block cache shared by the sub-pools.
+void TestBlockCache()
+{
+    const size_t frames = 20;
+    const size_t n = n_iterations / 10;
+    std::cout << "Time to fill and release two pools with " << n << " objects each for " << frames << " frames:\n";
+
+    auto run_frames = [frames, n](DataMultipool& mp) {
+        for (size_t frame = 0; frame < frames; ++frame)
+        {
+            for (size_t i = 0; i < n; ++i)
+                (void)mp.construct<B>();
+            mp.release<B>();
+
+            for (size_t i = 0; i < n; ++i)
+                (void)mp.construct<C>();
+            mp.release<C>();
+        }
+    };
+
+    {
+        DataMultipool mp(pool_init_block_size);
+        Timer timer("No cache: ");
+        run_frames(mp);
+    }
+
+    BlockCache cache;
+    {
+        DataMultipool mp(pool_init_block_size);
+        mp.set_block_cache(&cache);
+        Timer timer("Block cache: ");
+        run_frames(mp);
+    }
+
+    // After the first frame, every block comes from the cache.
+    std::cout << "Cache hits: " << cache.hits() << ", misses: " << cache.misses() << "\n";
+    assert(cache.hits() > cache.misses() * (frames / 2));
+    assert(cache.bytes() > 0);
+
+    cache.clear();
+    assert(cache.bytes() == 0);
+
+    // Blocks past their age are freed on the next use.
+    BlockCache shortLived(size_t(64) << 20, std::chrono::milliseconds(1));
+    {
+        Pool<B> pool(pool_init_block_size);
+        pool.set_block_cache(&shortLived);
+        for (size_t i = 0; i < n; ++i)
+            (void)pool.construct();
+    }
+    assert(shortLived.bytes() > 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    size_t size;
+    void* expired = shortLived.take(1, 1, size);
+    assert(expired == nullptr && shortLived.bytes() == 0);
+}
+
+// Build and discard a graph of objects every frame, releasing the pool's blocks
+// between frames or keeping them with reset().
+void TestReset()
+{
+    const size_t frames = 20;
+    const size_t n = n_iterations / 10;
+    std::cout << "Time to build, discard " << n << " objects of size " << sizeof(ParseNode) << " for "
+              << frames << " frames:\n";
+
+    {
+        Pool<ParseNode> pool(pool_init_block_size);
+        Timer timer("Release: ");
+        for (size_t frame = 0; frame < frames; ++frame)
+        {
+            for (size_t i = 0; i < n; ++i)
+                (void)pool.construct();
+            pool.release();
+        }
+    }
+    ParseNode::live = 0;
+
+    Pool<ParseNode> pool(pool_init_block_size);
+    size_t capacity = 0;
+    {
+        Timer timer("Reset: ");
+        for (size_t frame = 0; frame < frames; ++frame)
+        {
+            ParseNode::live = 0;
+            for (size_t i = 0; i < n; ++i)
+                (void)pool.construct();
+
+            // Only the first frame grows the pool.
+            assert(frame == 0 || pool.capacity() == capacity);
+            capacity = pool.capacity();
+
+            // Free some slots, which reset() must forget along with the rest.
+            ParseNode* p = pool.construct();
+            pool.destroy(p);
+            // The last frame runs the destructors.
+            pool.reset(frame + 1 == frames);
+        }
+    }
+    assert(ParseNode::live == 0 && pool.stats().m_live == 0);
+
+    // Once reset, the pool holds no live objects, so trim() returns every block.
+    pool.trim();
+    assert(pool.capacity() == 0 && pool.stats().m_blocks == 0);
+    (void)pool.construct();
+    assert(pool.capacity() > 0);
+    pool.reset(true);
+
+    // Likewise after a rollback, and for blocks never carved from.
+    {
+        Pool<ParseNode> scoped(pool_init_block_size);
+        (void)scoped.construct();
+        const auto checkpoint = scoped.mark();
+        for (size_t i = 0; i < n; ++i)
+            (void)scoped.construct();
+        scoped.rollback(checkpoint);
+        assert(ParseNode::live == 1);
+
+        scoped.trim();
+        assert(scoped.capacity() == pool_init_block_size && scoped.stats().m_live == 1);
+        scoped.reset(true);
+    }
+
+    // Zeroed objects stay zeroed after a reset reuses their slots.
+    Pool<std::array<size_t, 4>> zeroed(pool_init_block_size);
+    for (size_t i = 0; i < 1000; ++i)
+        zeroed.construct()->fill(i + 1);
+    zeroed.reset();
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        const auto* p = zeroed.construct_zeroed();
+        assert((*p)[0] == 0 && (*p)[3] == 0);
+    }
+
+    // reset_all() resets every sub-pool.
+    DataMultipool mp(pool_init_block_size);
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        (void)mp.construct<A>();
+        (void)mp.construct<D>();
+    }
+    const size_t capacityA = mp.get<A>().capacity();
+    mp.reset_all();
+    assert(mp.get<A>().stats().m_live == 0 && mp.get<D>().stats().m_live == 0);
+    for (size_t i = 0; i < 1000; ++i)
+        (void)mp.construct<A>();
+    assert(mp.get<A>().capacity() == capacityA);
+}
+
+// Leave most of a pool's slots free, then raise memory pressure through a fake
+// source and check the monitor trims the pool on its own thread.
+void TestPressureMonitor()
+{
+    std::atomic<bool> pressure{false};
+    PressureMonitor monitor([&pressure](std::chrono::milliseconds timeout) {
+        std::this_thread::sleep_for(std::min(timeout, std::chrono::milliseconds(1)));
+        return pressure.exchange(false);
+    });
+
+    std::mutex mutex;
+    Pool<B> pool(pool_init_block_size);
+    std::vector<B*> objects;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < n_iterations / 10; ++i)
+            objects.push_back(pool.construct());
+        // Free all but the newest tenth, emptying the older blocks.
+        for (size_t i = 0; i < objects.size() * 9 / 10; ++i)
+            pool.destroy(objects[i]);
+    }
+    const size_t capacity = pool.capacity();
+
+    size_t relieved = 0;
+    const size_t poolWatch = monitor.watch(pool, mutex, 0.25);
+    const size_t callbackWatch = monitor.watch([&relieved] { ++relieved; });
+
+    auto raise = [&monitor, &pressure] {
+        const size_t rises = monitor.rises();
+        pressure = true;
+        while (monitor.rises() == rises)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+
+    raise();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << "Pressure trimmed " << capacity << " slots to " << pool.capacity() << " for "
+                  << pool.stats().m_live << " live objects\n";
+        assert(pool.capacity() < capacity / 2);
+        assert(relieved == 1);
+    }
+
+    // Pools below their target are left alone.
+    const size_t trimmed = pool.capacity();
+    raise();
+    assert(pool.capacity() == trimmed && relieved == 2);
+
+    monitor.unwatch(poolWatch);
+    monitor.unwatch(callbackWatch);
+    raise();
+    assert(relieved == 2);
+
+    // The real sources can be created whether or not the system supports them.
+    PressureMonitor::Source psi = PressureMonitor::psi();
+    PressureMonitor::Source cgroup = PressureMonitor::cgroup_events();
+    (void)psi(std::chrono::milliseconds(0));
+    (void)cgroup(std::chrono::milliseconds(0));
+}
+
+// Compare a pool in one reserved address range with a block-based pool, and
+// check that slots are contiguous and addressable by index.
+void TestReservedPool()
+{
+    std::cout << "Time to allocate, free " << n_iterations << " objects of size " << sizeof(B)
+              << " in reserved address space:\n";
+
+    auto churn = [](auto& pool) {
+        std::vector<B*> objects;
+        objects.reserve(n_iterations);
+        for (size_t i = 0; i < n_iterations; ++i)
+            objects.push_back(pool.construct());
+        for (B* p : objects)
+            pool.destroy(p);
+    };
+
+    {
+        Pool<B> pool(pool_init_block_size);
+        Timer timer("Blocks: ");
+        churn(pool);
+    }
+
+    ReservedPool<B> pool(n_iterations * 4);
+    {
+        Timer timer("Reserved: ");
+        churn(pool);
+    }
+
+    // Slots are laid out by index, and growth never moves them.
+    std::vector<B*> objects;
+    for (size_t i = 0; i < n_iterations; ++i)
+        objects.push_back(pool.construct());
+    for (size_t i = 1; i < objects.size(); ++i)
+        assert(pool.index_of(objects[i]) < pool.max_size() && pool.at(pool.index_of(objects[i])) == objects[i]);
+    assert(pool.owns(objects.front()) && !pool.owns(&objects));
+
+    B* const first = pool.at(0);
+    const size_t capacity = pool.capacity();
+    while (pool.capacity() == capacity)
+        objects.push_back(pool.construct());
+    assert(pool.at(0) == first);
+
+    for (size_t i = 0; i < objects.size(); i += 2)
+        pool.destroy(objects[i]);
+    size_t visited = 0;
+    pool.visit_live([&visited](B&) { ++visited; });
+    assert(visited == objects.size() / 2 && pool.stats().m_live == visited);
+
+    // Freed slots are reused by index before carving new ones.
+    const auto reused = pool.index_of(pool.construct());
+    assert(reused % 2 == 0 && reused < objects.size());
+
+    pool.release();
+    assert(pool.capacity() == 0 && pool.stats().m_live == 0);
+    const auto index = pool.index_of(pool.construct());
+    assert(index == 0);
+
+    // Slots as small as an index, and running out of reserved space.
+    ReservedPool<uint32_t> small(1000, 1);
+    for (uint32_t i = 0; i < 1000; ++i)
+        *small.construct() = i;
+    bool threw = false;
+    try
+    {
+        (void)small.construct();
+    }
+    catch (const std::bad_alloc&)
+    {
+        threw = true;
+    }
+    assert(threw && *small.at(999) == 999);
+
+    ReservedPool<uint32_t> moved = std::move(small);
+    assert(*moved.at(500) == 500 && moved.capacity() >= 1000);
+}
+
+// Interleave long-lived cache entries with short-lived temporaries, then free
+// the temporaries and trim, with and without lifetime hints.
+void TestLifetimePool()
+{
+    const size_t n = n_iterations / 4;
+    const size_t longEvery = 10;
+    std::cout << "Capacity kept by " << n / longEvery << " long-lived among " << n << " objects of size "
+              << sizeof(B) << " after trim:\n";
+
+    Pool<B> mixed(pool_init_block_size);
+    std::vector<B*> temporaries;
+    for (size_t i = 0; i < n; ++i)
+    {
+        B* p = mixed.construct();
+        if (i % longEvery != 0)
+            temporaries.push_back(p);
+    }
+    for (B* p : temporaries)
+        mixed.destroy(p);
+    mixed.trim();
+
+    LifetimePool<B> hinted(pool_init_block_size);
+    std::vector<B*> cached;
+    temporaries.clear();
+    {
+        Timer timer("Hinted construct, destroy: ");
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (i % longEvery == 0)
+                cached.push_back(hinted.construct(Lifetime::Long));
+            else
+                temporaries.push_back(hinted.construct(Lifetime::Short));
+        }
+        for (B* p : temporaries)
+            hinted.destroy(p);
+    }
+    hinted.trim();
+
+    std::cout << "Mixed: " << mixed.capacity() << " slots, hinted: " << hinted.capacity() << " slots\n";
+    assert(hinted.capacity() < mixed.capacity() / 4);
+    assert(hinted.get(Lifetime::Short).stats().m_live == 0);
+    assert(hinted.get(Lifetime::Long).stats().m_live == cached.size());
+
+    // Objects are destroyed through their own class's blocks.
+    for (B* p : cached)
+        hinted.destroy(p);
+    assert(hinted.get(Lifetime::Long).stats().m_live == 0);
+
+    // Lifetime classes can be numbered.
+    LifetimePool<B, 3> numbered(pool_init_block_size);
+    B* p = numbered.construct(Lifetime{2});
+    assert(numbered.get(Lifetime{2}).stats().m_live == 1);
+    numbered.destroy(p);
+    assert(numbered.get(Lifetime{2}).stats().m_live == 0);
+}
+
+// Register pools, sample their stats directly and through the sampler thread,
+// and check what the file sinks write.
+void TestRegistry()
+{
+    PoolRegistry& registry = PoolRegistry::instance();
+
+    Pool<B> pool(pool_init_block_size);
+    DataMultipool mp(pool_init_block_size);
+    auto poolRegistration = registry.add("parser", pool);
+
+    std::vector<B*> objects;
+    for (size_t i = 0; i < 1000; ++i)
+        objects.push_back(pool.construct());
+    for (size_t i = 0; i < 100; ++i)
+        pool.destroy(objects[i]);
+
+    {
+        auto mpRegistration = registry.add("scene", mp);
+        (void)mp.construct<C>();
+
+        auto samples = registry.sample();
+        assert(samples.size() == 5);
+        assert(samples[0].m_name == "parser" && samples[0].m_type == "B");
+        assert(samples[0].m_stats.m_live == 900 && samples[0].m_stats.m_capacity >= 1000);
+        assert(samples[3].m_name == "scene" && samples[3].m_type == "C" && samples[3].m_stats.m_live == 1);
+    }
+    assert(registry.sample().size() == 1);
+
+    // A rollback restores the live count from the mark.
+    const auto checkpoint = pool.mark();
+    for (size_t i = 0; i < 100; ++i)
+        (void)pool.construct();
+    pool.rollback(checkpoint);
+    assert(pool.stats().m_live == 900);
+
+    const std::string promPath = "/tmp/pool_stats_test.prom";
+    const std::string jsonPath = "/tmp/pool_stats_test.json";
+    std::atomic<size_t> sinkCalls{0};
+    registry.start_sampler(std::chrono::milliseconds(1), [&](const std::vector<PoolRegistry::Sample>& samples) {
+        PoolRegistry::prometheus_file(promPath)(samples);
+        PoolRegistry::json_file(jsonPath)(samples);
+        ++sinkCalls;
+    });
+
+    // Keep allocating while the sampler reads the counters.
+    while (sinkCalls < 5)
+        pool.destroy(pool.construct());
+    registry.stop_sampler();
+
+    // The last sample may have caught one object in flight.
+    std::stringstream prom;
+    prom << std::ifstream(promPath).rdbuf();
+    assert(prom.str().find("pool_live_slots{pool=\"parser\",type=\"B\"} 90") != std::string::npos);
+
+    std::stringstream json;
+    json << std::ifstream(jsonPath).rdbuf();
+    assert(json.str().find("\"pool\": \"parser\", \"type\": \"B\"") != std::string::npos);
+
+    // Control characters in names are escaped in JSON.
+    PoolRegistry::json_file(jsonPath)({{"tab\there\x01", "B", pool.stats()}});
+    json.str("");
+    json << std::ifstream(jsonPath).rdbuf();
+    assert(json.str().find("\"pool\": \"tab\\u0009here\\u0001\"") != std::string::npos);
+
+    std::remove(promPath.c_str());
+    std::remove(jsonPath.c_str());
+    std::cout << "Registry sampled " << sinkCalls << " times\n";
+}
+
+// Free all but a sparse set of objects, so few blocks can be trimmed, and give
+// the free pages back with decommit().
+void TestDecommit()
+{
+    using Big = std::array<std::byte, 256>;
+    const size_t n = n_iterations / 8;
+    const size_t stride = 64;
+
+    Pool<Big> pool(pool_init_block_size);
+    std::vector<Big*> objects(n);
+    for (auto& p : objects)
+    {
+        p = pool.construct();
+        p->fill(std::byte{1});
+    }
+
+    std::vector<Big*> live;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i % stride == 0)
+            live.push_back(objects[i]);
+        else
+            pool.destroy(objects[i]);
+    }
+
+    // Only the smallest blocks can be trimmed.
+    const size_t untrimmed = pool.capacity();
+    pool.trim();
+    const size_t capacity = pool.capacity();
+    assert(capacity > untrimmed * 9 / 10);
+
+    const size_t before = ResidentMiB();
+    size_t released = 0;
+    {
+        Timer timer("Decommit: ");
+        released = pool.decommit();
+    }
+    std::cout << "Released " << released / (1024 * 1024) << " MiB of " << capacity * sizeof(Big) / (1024 * 1024)
+              << " MiB with 1 in " << stride << " objects live (RSS " << before << " -> " << ResidentMiB() << " MiB)\n";
+    assert(released > 0);
+
+    size_t visited = 0;
+    pool.visit_live([&visited](Big& big) { visited += big[0] == std::byte{1}; });
+    assert(visited == live.size());
+
+    // Decommitted slots are reused before the pool grows.
+    for (size_t i = live.size(); i < n; ++i)
+        (void)pool.construct();
+    assert(pool.capacity() == capacity);
+    for (Big* p : live)
+        assert((*p)[255] == std::byte{1});
+}
+
+// Plain structs with the sizes of A..D, for value-initialization.
+template <size_t N>
+struct Plain { std::byte data[N]; };
+
+template <size_t N>
+void ZeroedAlloc()
+{
+    const size_t n = n_iterations / 4;
+    std::cout << "Time to construct " << n << " zeroed objects of size " << N << ":\n";
+
+    size_t sum = 0;
+    {
+        Pool<Plain<N>> pool(pool_init_block_size);
+        Timer timer("Value-init: ");
+        for (size_t i = 0; i < n; ++i)
+            sum += static_cast<size_t>(pool.construct()->data[N - 1]);
+    }
+    {
+        Pool<Plain<N>> pool(pool_init_block_size);
+        Timer timer("Zeroed: ");
+        for (size_t i = 0; i < n; ++i)
+            sum += static_cast<size_t>(pool.construct_zeroed()->data[N - 1]);
+    }
+    assert(sum == 0);
+}
+
+// Compare value-initializing construct() with construct_zeroed(), then check
+// that reused and rolled-back slots come back zeroed too.
+void TestConstructZeroed()
+{
+    ZeroedAlloc<16>();
+    ZeroedAlloc<40>();
+    ZeroedAlloc<72>();
+    ZeroedAlloc<136>();
+
+    auto isZero = [](const Plain<40>* p) {
+        return std::all_of(std::begin(p->data), std::end(p->data), [](std::byte b) { return b == std::byte{0}; });
+    };
+
+    Pool<Plain<40>> pool(pool_init_block_size);
+    std::vector<Plain<40>*> objects;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        Plain<40>* p = objects.emplace_back(pool.construct_zeroed());
+        assert(isZero(p));
+        std::fill(std::begin(p->data), std::end(p->data), std::byte{0xff});
+    }
+
+    for (size_t i = 0; i < objects.size(); i += 2)
+        pool.destroy(objects[i]);
+    for (size_t i = 0; i < objects.size(); i += 2)
+    {
+        const Plain<40>* p = pool.construct_zeroed();
+        assert(isZero(p));
+    }
+
+    const auto checkpoint = pool.mark();
+    for (size_t i = 0; i < 100; ++i)
+    {
+        Plain<40>* p = pool.construct_zeroed();
+        std::fill(std::begin(p->data), std::end(p->data), std::byte{0xff});
+    }
+    pool.rollback(checkpoint);
+    for (size_t i = 0; i < 200; ++i)
+    {
+        const Plain<40>* p = pool.construct_zeroed();
+        assert(isZero(p));
+    }
+}
+
+// Expensive to construct, since it preallocates a buffer, but cheap to reset.
+struct Buffered
+{
+    Buffered() : buffer(4096) { ++constructed; }
+    ~Buffered() { ++destroyed; }
+
+    std::vector<std::byte> buffer;
+    size_t used = 0;
+    static inline size_t constructed = 0;
+    static inline size_t destroyed = 0;
+};
+
+// Handle requests that each need a few buffered objects, either constructing
+// and destroying them every time or recycling them. Then trim the pools.
+void TestRecycle()
+{
+    const size_t n_requests = n_iterations / 4;
+    std::cout << "Time to serve " << n_requests << " requests using 4 objects of size " << sizeof(Buffered) << ":\n";
+
+    auto serve = [n_requests](auto get, auto put) {
+        for (size_t i = 0; i < n_requests; ++i)
+        {
+            std::array<Buffered*, 4> objects;
+            for (auto& p : objects)
+            {
+                p = get();
+                p->buffer[p->used++] = std::byte{1};
+            }
+            for (auto p : objects)
+                put(p);
+        }
+    };
+
+    {
+        Pool<Buffered> pool(pool_init_block_size);
+        Timer timer("Construct: ");
+        serve([&pool] { return pool.construct(); }, [&pool](Buffered* p) { pool.destroy(p); });
+    }
+
+    Buffered::constructed = Buffered::destroyed = 0;
+    Pool<Buffered> pool(pool_init_block_size);
+    {
+        Timer timer("Recycle: ");
+        serve([&pool] { return pool.acquire([](Buffered& b) { b.used = 0; }); },
+              [&pool](Buffered* p) { pool.recycle(p); });
+    }
+    assert(Buffered::constructed == 4 && Buffered::destroyed == 0);
+
+    pool.trim();
+    assert(Buffered::destroyed == 4);
+
+    // Trimming returns blocks with no live objects and relinks the rest of the
+    // free slots in address order.
+    Pool<A> small(pool_init_block_size);
+    std::vector<A*> objects(n_iterations / 8);
+    for (auto& p : objects)
+        p = small.construct();
+    for (size_t i = 0; i + 1 < objects.size(); ++i)
+        small.destroy(objects[i]);
+
+    const size_t before = small.capacity();
+    small.trim();
+    std::cout << "Capacity after trim: " << small.capacity() << " of " << before << "\n";
+    assert(small.capacity() < before / 2);
+
+    A* first = small.construct();
+    A* second = small.construct();
+    assert(first < second);
+}
+
+// A tree node sized to one cache line.
+struct TreeNode
+{
+    std::array<TreeNode*, 3> children{};
+    std::byte data[40]{};
+};
+
+// Build a forest of parents with three children each, then edit it the way an
+// incremental parser would: batches of parents have their children replaced,
+// long after the parents were created. `create(parent)` makes a child. Returns
+// the parents.
+template <typename Create>
+std::vector<TreeNode*> EditForest(Pool<TreeNode>& pool, size_t n_parents, Create create)
+{
+    constexpr size_t batchSize = 4;
+
+    std::vector<TreeNode*> parents;
+    for (size_t i = 0; i < n_parents; ++i)
+    {
+        TreeNode* parent = parents.emplace_back(pool.construct());
+        for (TreeNode*& child : parent->children)
+            child = pool.construct();
+    }
+
+    for (size_t round = 0; round < n_parents / batchSize; ++round)
+    {
+        std::array<TreeNode*, batchSize> batch;
+        for (TreeNode*& parent : batch)
+        {
+            parent = parents[static_cast<size_t>(rand()) % n_parents];
+            for (TreeNode*& child : parent->children)
+            {
+                pool.destroy(child);
+                child = nullptr;
+            }
+        }
+
+        for (TreeNode* parent : batch)
+            for (TreeNode*& child : parent->children)
+                if (child == nullptr)
+                    child = create(parent);
+    }
+
+    return parents;
+}
+
+// Sum over the forest, visiting each parent's children. Also counts the
+// children that share a page with their parent.
+size_t WalkForest(const std::vector<TreeNode*>& parents, size_t& samePage)
+{
+    size_t total = 0;
+    samePage = 0;
+    for (const TreeNode* parent : parents)
+    {
+        for (const TreeNode* child : parent->children)
+        {
+            total += static_cast<size_t>(child->data[0]) + 1;
+            samePage += reinterpret_cast<uintptr_t>(child) / 4096 == reinterpret_cast<uintptr_t>(parent) / 4096;
+        }
+    }
+    return total;
+}
+
+// Compare a forest whose edited children are placed anywhere with one whose
+// children are placed near their parents.
+void TestConstructNear()
+{
+    const size_t n_parents = n_iterations / 8;
+    std::cout << "Time to walk " << n_parents << " edited parents and their children:\n";
+
+    size_t plainSamePage = 0;
+    {
+        Pool<TreeNode> pool(pool_init_block_size);
+        auto parents = EditForest(pool, n_parents, [&pool](TreeNode*) { return pool.construct(); });
+        size_t total = 0;
+        {
+            Timer timer("Anywhere: ");
+            total = WalkForest(parents, plainSamePage);
+        }
+        assert(total == 3 * n_parents);
+    }
+
+    size_t nearSamePage = 0;
+    {
+        Pool<TreeNode> pool(pool_init_block_size);
+        auto parents = EditForest(pool, n_parents, [&pool](TreeNode* parent) { return pool.construct_near(parent); });
+        size_t total = 0;
+        {
+            Timer timer("Near: ");
+            total = WalkForest(parents, nearSamePage);
+        }
+        assert(total == 3 * n_parents);
+    }
+
+    std::cout << "Children on their parent's page: " << plainSamePage << " anywhere vs " << nearSamePage << " near\n";
+    assert(nearSamePage > plainSamePage);
+}
+
+// An object plus the companions it is always used with.
+using Companions = std::tuple<A*, B*, C*>;
+
+// Touch every member of each group, visiting the groups in the given order.
+size_t TouchGroups(const std::vector<Companions>& groups, const std::vector<size_t>& order)
+{
+    size_t total = 0;
+    for (size_t i : order)
+    {
+        auto [a, b, c] = groups[i];
+        total += static_cast<size_t>(a->data[0]) + static_cast<size_t>(b->data[0]) + static_cast<size_t>(c->data[0]) + 3;
+    }
+    return total;
+}
+
+// Throws from its constructor while `fail` is set.
+struct Fragile
+{
+    Fragile()
+    {
+        if (fail)
+            throw std::runtime_error("Fragile");
+    }
+
+    static inline bool fail = false;
+};
+
+// Build the same groups of companion objects from separate per-type pools and
+// as co-located groups, then compare the time to visit them in random order.
+void TestConstructGroup()
+{
+    constexpr size_t n_groups = n_iterations / 4;
+    DataMultipool& mp = MultipoolInstance::get();
+
+    std::vector<size_t> order(n_groups);
+    for (size_t i = 0; i < n_groups; ++i)
+        order[i] = i;
+    for (size_t i = n_groups - 1; i > 0; --i)
+        std::swap(order[i], order[static_cast<size_t>(rand()) % (i + 1)]);
+
+    std::vector<Companions> separate;
+    std::vector<Companions> grouped;
+    separate.reserve(n_groups);
+    grouped.reserve(n_groups);
+    for (size_t i = 0; i < n_groups; ++i)
+    {
+        separate.emplace_back(mp.construct<A>(), mp.construct<B>(), mp.construct<C>());
+        grouped.push_back(mp.construct_group<A, B, C>());
+    }
+
+    for (auto [a, b, c] : grouped)
+    {
+        // Members are laid out in order, back to back.
+        assert(reinterpret_cast<std::byte*>(b) == reinterpret_cast<std::byte*>(a) + sizeof(A));
+        assert(reinterpret_cast<std::byte*>(c) == reinterpret_cast<std::byte*>(b) + sizeof(B));
+    }
+
+    std::cout << "Time to visit " << n_groups << " groups of companion objects in random order:\n";
+    size_t total = 0;
+    {
+        Timer timer("Separate: ");
+        total = TouchGroups(separate, order);
+    }
+    assert(total == 3 * n_groups);
+    {
+        Timer timer("Grouped: ");
+        total = TouchGroups(grouped, order);
+    }
+    assert(total == 3 * n_groups);
+
+    // Freed group slots are reused by groups of the same footprint.
+    auto [a, b, c] = grouped.back();
+    mp.destroy_group(grouped.back());
+    auto same = mp.construct_group<A, B, C>(A{}, B{}, C{});
+    assert(std::get<0>(same) == a && std::get<1>(same) == b && std::get<2>(same) == c);
+    mp.destroy_group(same);
+
+    // A member that throws takes down the members built before it, and the
+    // group's slot is freed.
+    auto kept = mp.construct_group<ParseNode, ParseNode, Fragile>();
+    mp.destroy_group(kept);
+    Fragile::fail = true;
+    bool threw = false;
+    try
+    {
+        (void)mp.construct_group<ParseNode, ParseNode, Fragile>();
+    }
+    catch (const std::runtime_error&)
+    {
+        threw = true;
+    }
+    Fragile::fail = false;
+    assert(threw && ParseNode::live == 0);
+    auto again = mp.construct_group<ParseNode, ParseNode, Fragile>();
+    assert(std::get<0>(again) == std::get<0>(kept));
+    mp.destroy_group(again);
+
+    mp.release_all();
+}
+
+int main()
+{
+    // Test mass allocation then deallocation of various object sizes.
+    // Exercises the Pool class.
+    TestMassAlloc<A>();
+    TestMassAlloc<B>();
+    TestMassAlloc<C>();
+    TestMassAlloc<D>();
+
+    // Test pseudo-random mixed allocation/deallocation of multiple object types.
+    // Exercises the Multipool class.
+    TestMixedAlloc();
+
+    // Test class-level new/delete with cross-thread deletes.
+    // Exercises the PoolAllocated mixin.
+    TestPoolAllocated();
+
+    // Test oversubscribed threads sharing per-CPU caches versus per-thread caches.
+    // Exercises the PerCpuPool class.
+    TestPerCpuPool();
+
+    // Test free slots migrating from idle threads to busy ones.
+    // Exercises ThreadLocalPool's rebalancing.
+    TestRebalancing();
+
+    // Test discarding speculative allocations in bulk.
+    // Exercises Pool's mark and rollback.
+    TestCheckpoint();
+
+    // Test allocating short arrays of adjacent objects.
+    // Exercises Pool's contiguous allocation.
+    TestContiguous();
+
+    // Test constructing objects from a runtime type tag.
+    // Exercises Multipool's jump-table dispatch.
+    TestConstructByIndex();
+
+    // Test visiting every live object of every type.
+    // Exercises Multipool's live-object visitor.
+    TestVisitLive();
+
+    // Test a single shared pool for a whole class hierarchy.
+    // Exercises the PolyPool class.
+    TestPolyPool();
+
+    // Test placing companion objects of different types side by side.
+    // Exercises the Multipool::construct_group() method.
+    TestConstructGroup();
+
+    // Test placing children near their parents after the tree is edited.
+    // Exercises the Pool::construct_near() method.
+    TestConstructNear();
+
+    // Test moving expensive destructors off the request path.
+    // Exercises Pool::destroy_deferred() and PerCpuPool's background drainer.
+    TestDeferredDestroy();
+
+    // Test keeping expensive objects constructed between uses.
+    // Exercises Pool::recycle(), acquire() and trim().
+    TestRecycle();
+
+    // Test value-initialized objects from pre-zeroed blocks.
+    // Exercises the Pool::construct_zeroed() method.
+    TestConstructZeroed();
+
+    // Test giving free pages inside partly used blocks back to the OS.
+    // Exercises the Pool::decommit() method.
+    TestDecommit();
+
+    // Test sizing blocks by the observed allocation rate.
+    // Exercises the AdaptiveGrowth policy.
+    TestAdaptiveGrowth();
+
+    // Test exporting stats of named pools.
+    // Exercises the PoolRegistry class.
+    TestRegistry();
+
+    // Test sampling the call stacks that construct pooled objects.
+    // Exercises the HeapProfiler class.
+    TestHeapProfiler();
+
+    // Test reporting pool events to an observer policy.
+    // Exercises the PoolObserver class.
+    TestObserver();
+
+    // Test merging pools built on several threads and stealing their free blocks.
+    // Exercises the merge and steal_free functions of the Pool class.
+    TestMerge();
+
+    // Test reusing released blocks across the pools of a Multipool.
+    // Exercises the BlockCache class.
+    TestBlockCache();
+
+    // Test discarding every object while keeping the blocks.
+    // Exercises the reset functions of the Pool and Multipool classes.
+    TestReset();
+
+    // Test trimming pools when memory pressure rises.
+    // Exercises the PressureMonitor class.
+    TestPressureMonitor();
+
+    // Test a pool whose slots are contiguous in one reserved address range.
+    // Exercises the ReservedPool class.
+    TestReservedPool();
+
+    // Test keeping short- and long-lived objects in separate blocks.
+    // Exercises the LifetimePool class.
+    TestLifetimePool();
 
     return 0;
 }